@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <x86intrin.h>
+
+#include "tree.h"
+#include "random.h"
+#include "parallel.h"
+#include "partition.h"
+#include "fastrand.h"
+#include "blocked_tree.h"
+#include "compressed_tree.h"
+#include "radix_table.h"
+#include "learned_index.h"
+#include "util.h"
+
+// benchmark harness: times only the search, over warm-up and repeated runs,
+// and appends one CSV row per configuration so sweeps can be compared
+// across commits
+
+#define MAX_RUNS 1000
+
+typedef enum {
+    MODE_SCALAR,     // binary_search_partition, one probe at a time
+    MODE_SIMD,       // binary_search_partition_simd, one probe at a time
+    MODE_BATCH,      // binary_search_partition_batch (9-5-9 uses the hard-coded kernel)
+    MODE_AMAC,       // binary_search_partition_amac
+    MODE_PARTITION,  // partition_probes, histogram and scatter
+    MODE_SORTED,     // binary_search_partition_sorted, on probes sorted during setup
+    MODE_BLOCKED,    // blocked_search_partition_batch, on a blocked copy of the tree
+    MODE_COMPRESSED, // compressed_search_partition_batch, on a compressed copy of the tree
+    MODE_RADIX,      // radix_search_partition_batch, top levels from a jump table
+    MODE_LEARNED,    // learned_search_partition_batch, positions predicted by linear models
+    MODE_INTERVAL,   // binary_search_partition_intervals, [probe, probe + width] per probe
+    MODE_HISTOGRAM,  // histogram_probes, counts per range on per-thread counters
+    NUM_MODES
+} bench_mode;
+
+static const char *mode_names[NUM_MODES] = {
+    "scalar", "simd", "batch", "amac", "partition", "sorted", "blocked", "compressed", "radix", "learned",
+    "interval", "histogram"
+};
+
+// hardware counters read through perf_event_open, -1 when unavailable
+enum { COUNTER_L1D_MISSES, COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES, NUM_COUNTERS };
+
+static const struct {
+    uint32_t    type;
+    uint64_t    config;
+    const char *name;
+} counter_defs[NUM_COUNTERS] = {
+    { PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),       "l1d_misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,  "llc_misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+};
+
+typedef struct {
+    bench_mode      mode;
+    int32_t         group_size;
+    int32_t         num_threads;
+    partition_tree *tree;
+    size_t          num_probes;
+    int32_t        *probes;
+    int32_t        *ranges;
+    partition_run  *runs;
+    blocked_tree   *blocked;
+    compressed_tree *compressed;
+    radix_table    *radix;
+    learned_index  *learned;
+    int32_t        *his;        // interval upper bounds
+    partition_interval *intervals;
+} bench_config;
+
+static int open_counter(int32_t i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = counter_defs[i].type;
+    attr.config         = counter_defs[i].config;
+    attr.disabled       = 1;
+    attr.inherit        = 1;  // count the -t worker threads too
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void search(bench_config *c) {
+    partition_tree *tree = c->tree;
+
+    switch (c->mode) {
+    case MODE_SCALAR: {
+        size_t i;
+        for (i = 0; i < c->num_probes; i++)
+            binary_search_partition(tree, c->probes[i], &c->ranges[i]);
+        break;
+    }
+    case MODE_SIMD: {
+        size_t i;
+        for (i = 0; i < c->num_probes; i++)
+            binary_search_partition_simd(tree, c->probes[i], &c->ranges[i]);
+        break;
+    }
+    case MODE_BATCH:
+        if (c->num_threads > 0)
+            parallel_search_partition(tree, c->num_probes, c->probes, c->ranges,
+                                      0, c->num_threads, NULL);
+        else if (tree->num_levels == 3 && tree->fanouts[0] == 9 &&
+                 tree->fanouts[1] == 5 && tree->fanouts[2] == 9)
+            binary_search_partition_959(tree, c->num_probes, c->probes, c->ranges);
+        else
+            binary_search_partition_batch(tree, c->num_probes, c->probes, c->ranges);
+        break;
+    case MODE_AMAC:
+        if (c->num_threads > 0)
+            parallel_search_partition(tree, c->num_probes, c->probes, c->ranges,
+                                      c->group_size, c->num_threads, NULL);
+        else
+            binary_search_partition_amac(tree, c->num_probes, c->probes, c->ranges,
+                                         c->group_size);
+        break;
+    case MODE_SORTED:
+        binary_search_partition_sorted(tree, c->num_probes, c->probes, c->runs);
+        break;
+    case MODE_BLOCKED:
+        blocked_search_partition_batch(c->blocked, c->num_probes, c->probes, c->ranges);
+        break;
+    case MODE_COMPRESSED:
+        compressed_search_partition_batch(c->compressed, c->num_probes, c->probes, c->ranges);
+        break;
+    case MODE_RADIX:
+        radix_search_partition_batch(tree, c->radix, c->num_probes, c->probes, c->ranges);
+        break;
+    case MODE_LEARNED:
+        learned_search_partition_batch(c->learned, c->num_probes, c->probes, c->ranges);
+        break;
+    case MODE_INTERVAL:
+        binary_search_partition_intervals(tree, c->num_probes, c->probes, c->his, c->intervals);
+        break;
+    case MODE_PARTITION: {
+        partition_output out;
+        partition_probes(tree, c->num_probes, c->probes, NULL, &out);
+        destroy_partition_output(&out);
+        break;
+    }
+    case MODE_HISTOGRAM: {
+        partition_histogram hist;
+        histogram_probes(tree, c->num_probes, c->probes, 0, c->num_threads, NULL, &hist);
+        destroy_partition_histogram(&hist);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static int double_cmp(const void *x, const void *y) {
+    double a = *(const double *) x;
+    double b = *(const double *) y;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-m scalar|simd|batch|amac|partition|sorted|blocked|compressed|radix|learned|interval|histogram]\n"
+            "          [-g <amac group size>] [-t <num threads>] [-w <warm-up runs>] [-r <runs>]\n"
+            "          [-s <seed>] [-o <csv file>] [-l <label>] [-A] [-H 2m|1g] [-F <generator threads>]\n"
+            "          [-B <block bytes>] [-C 8|16|32] [-J <jump table bits, 0 for auto>]\n"
+            "          [-M <learned segments, 0 for auto>] [-Q <interval width>]\n"
+            "          <num keys> <num probes> <list of fanouts...>\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    bench_config c = { MODE_BATCH, 16, 0, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    int32_t num_warmups = 2;
+    int32_t num_runs    = 10;
+    uint32_t seed       = 1;
+    const char *csv_path = NULL;
+    const char *label    = "";
+    int32_t alloc_flags  = 0;
+    int32_t gen_threads  = 0;
+    size_t  block_bytes  = BLOCKED_DEFAULT_BYTES;
+    int32_t min_width    = 8;
+    int32_t radix_bits   = 0;
+    int32_t num_segments = 0;
+    int32_t interval_width = 1000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:g:t:w:r:s:o:l:AH:F:B:C:J:M:Q:")) != -1) {
+        switch (opt) {
+        case 'm': {
+            int32_t m;
+            for (m = 0; m < NUM_MODES; m++)
+                if (strcmp(optarg, mode_names[m]) == 0)
+                    break;
+            if (m == NUM_MODES) {
+                usage(argv[0]);
+                return 1;
+            }
+            c.mode = m;
+            break;
+        }
+        case 'g': c.group_size  = atoi(optarg); break;
+        case 't': c.num_threads = atoi(optarg); break;
+        case 'w': num_warmups   = atoi(optarg); break;
+        case 'r': num_runs      = atoi(optarg); break;
+        case 's': seed          = strtoul(optarg, NULL, 10); break;
+        case 'o': csv_path      = optarg; break;
+        case 'l': label         = optarg; break;
+        case 'A': alloc_flags  |= TREE_ALLOC_ARENA; break;
+        case 'F': gen_threads   = atoi(optarg); break;
+        case 'B': block_bytes   = strtoul(optarg, NULL, 10); break;
+        case 'C': min_width     = atoi(optarg); break;
+        case 'J': radix_bits    = atoi(optarg); break;
+        case 'M': num_segments  = atoi(optarg); break;
+        case 'Q': interval_width = atoi(optarg); break;
+        case 'H':
+            if (strcmp(optarg, "2m") == 0) {
+                alloc_flags |= TREE_ALLOC_HUGE_2MB;
+            } else if (strcmp(optarg, "1g") == 0) {
+                alloc_flags |= TREE_ALLOC_HUGE_1GB;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind < 3 || block_bytes == 0 ||
+        (min_width != 8 && min_width != 16 && min_width != 32) ||
+        radix_bits < 0 || radix_bits > RADIX_MAX_BITS || num_segments < 0 ||
+        interval_width < 0 || num_runs < 1 || num_runs > MAX_RUNS || num_warmups < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // only the batched and AMAC searches have a multithreaded driver
+    if (c.mode != MODE_BATCH && c.mode != MODE_AMAC)
+        c.num_threads = 0;
+
+    int32_t num_keys   = atoi(argv[optind]);
+    c.num_probes       = strtoul(argv[optind+1], NULL, 10);
+    int32_t num_levels = argc - optind - 2;
+    int32_t fanouts[num_levels];
+    char    shape[256] = "";
+    int32_t i;
+    for (i = 0; i < num_levels; i++) {
+        fanouts[i] = atoi(argv[optind+2+i]);
+        snprintf(shape + strlen(shape), sizeof(shape) - strlen(shape),
+                 i ? "-%d" : "%d", fanouts[i]);
+    }
+
+    // setup, not timed
+    // -F: multithreaded generator, for key and probe counts where the
+    // provided one takes longer than the runs
+    rand32_t   *gen  = rand32_init(seed);
+    fastrand_t *fast = gen_threads > 0 ? fastrand_init(seed, gen_threads) : NULL;
+    int32_t    *keys = fast ? fastrand_generate_sorted_unique(num_keys, fast)
+                            : generate_sorted_unique(num_keys, gen);
+    partition_tree tree;
+    init_partition_tree_alloc(num_keys, keys, num_levels, fanouts, alloc_flags, &tree);
+    c.tree   = &tree;
+    c.probes = fast ? fastrand_generate(c.num_probes, fast) : generate(c.num_probes, gen);
+    c.ranges = malloc(sizeof(int32_t) * c.num_probes + 1);
+    if (c.mode == MODE_SORTED) {
+        int32_t *tmp = malloc(sizeof(int32_t) * c.num_probes + 1);
+        radix_sort_int32(c.num_probes, c.probes, tmp, gen_threads > 0 ? gen_threads : 1);
+        free(tmp);
+        c.runs = malloc(sizeof(partition_run) * c.num_probes + 1);
+    }
+    blocked_tree blocked;
+    if (c.mode == MODE_BLOCKED) {
+        init_blocked_tree(&tree, block_bytes, &blocked);
+        c.blocked = &blocked;
+    }
+    compressed_tree compressed;
+    if (c.mode == MODE_COMPRESSED) {
+        init_compressed_tree(&tree, min_width, &compressed);
+        c.compressed = &compressed;
+    }
+    radix_table radix;
+    if (c.mode == MODE_RADIX) {
+        init_radix_table(&tree, radix_bits, &radix);
+        c.radix = &radix;
+    }
+    learned_index learned;
+    if (c.mode == MODE_LEARNED) {
+        init_learned_index(&tree, num_segments, LEARNED_MAX_ERROR, &learned);
+        c.learned = &learned;
+    }
+    if (c.mode == MODE_INTERVAL) {
+        size_t j;
+        c.his       = malloc(sizeof(int32_t) * c.num_probes + 1);
+        c.intervals = malloc(sizeof(partition_interval) * c.num_probes + 1);
+        for (j = 0; j < c.num_probes; j++)
+            c.his[j] = c.probes[j] > INT32_MAX - interval_width ? INT32_MAX
+                                                                : c.probes[j] + interval_width;
+    }
+
+    int counters[NUM_COUNTERS];
+    for (i = 0; i < NUM_COUNTERS; i++)
+        counters[i] = open_counter(i);
+
+    for (i = 0; i < num_warmups; i++)
+        search(&c);
+
+    double   times[MAX_RUNS];
+    uint64_t cycles = 0;
+    int64_t  counts[NUM_COUNTERS] = { 0 };
+    for (i = 0; i < num_runs; i++) {
+        int32_t j;
+        for (j = 0; j < NUM_COUNTERS; j++) {
+            if (counters[j] < 0)
+                continue;
+            ioctl(counters[j], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[j], PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        double   start       = now();
+        uint64_t start_cycle = __rdtsc();
+        search(&c);
+        uint64_t end_cycle   = __rdtsc();
+        times[i] = now() - start;
+        cycles  += end_cycle - start_cycle;
+
+        for (j = 0; j < NUM_COUNTERS; j++) {
+            uint64_t value;
+            if (counters[j] < 0)
+                continue;
+            ioctl(counters[j], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters[j], &value, sizeof(value)) == sizeof(value))
+                counts[j] += value;
+        }
+    }
+
+    qsort(times, num_runs, sizeof(double), double_cmp);
+    double median = times[num_runs / 2];
+    double probes = (double) c.num_probes;
+
+    FILE *csv = stdout;
+    if (csv_path && !(csv = fopen(csv_path, "a"))) {
+        perror(csv_path);
+        return 1;
+    }
+
+    // header only for a new file, so sweeps can append to the same one
+    if (csv == stdout || (fseek(csv, 0, SEEK_END) == 0 && ftell(csv) == 0)) {
+        fprintf(csv, "label,mode,isa,fanouts,num_keys,num_probes,threads,group_size,runs,"
+                "median_ms,min_ms,ns_per_probe,cycles_per_probe,mprobes_per_s");
+        for (i = 0; i < NUM_COUNTERS; i++)
+            fprintf(csv, ",%s_per_probe", counter_defs[i].name);
+        fprintf(csv, "\n");
+    }
+
+    fprintf(csv, "%s,%s,%s,%s,%d,%zu,%d,%d,%d,%.3f,%.3f,%.3f,%.2f,%.2f",
+            label, mode_names[c.mode], simd_isa_name(partition_tree_isa()), shape,
+            num_keys, c.num_probes, c.num_threads,
+            c.mode == MODE_AMAC ? c.group_size : 0, num_runs,
+            median * 1000, times[0] * 1000,
+            median * 1e9 / probes, cycles / (double) num_runs / probes,
+            probes / median / 1e6);
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (counters[i] < 0)
+            fprintf(csv, ",");
+        else
+            fprintf(csv, ",%.4f", counts[i] / (double) num_runs / probes);
+    }
+    fprintf(csv, "\n");
+
+    if (csv != stdout)
+        fclose(csv);
+    for (i = 0; i < NUM_COUNTERS; i++)
+        if (counters[i] >= 0)
+            close(counters[i]);
+
+    if (c.blocked)
+        destroy_blocked_tree(c.blocked);
+    if (c.compressed)
+        destroy_compressed_tree(c.compressed);
+    if (c.radix)
+        destroy_radix_table(c.radix);
+    if (c.learned)
+        destroy_learned_index(c.learned);
+    destroy_partition_tree(&tree);
+    free(c.probes);
+    free(c.ranges);
+    free(c.runs);
+    free(c.his);
+    free(c.intervals);
+    free(keys);
+    free(gen);
+    free(fast);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "blocked_tree.h"
+#include "tree.h"
+#include "tree_kernels.h"
+#include "util.h"
+
+void init_blocked_tree(partition_tree *tree, size_t block_bytes, blocked_tree *bt) {
+    int32_t height = tree->num_levels;
+    size_t  line   = TREE_NODE_ALIGN / sizeof(int32_t);
+
+    bt->num_levels = height;
+    bt->num_keys   = tree->num_keys;
+    bt->num_groups = 0;
+    bt->levels     = malloc_or_die(sizeof(blocked_level) * height);
+
+    // nodes of each level in one block of its group
+    size_t per_block[height];
+    size_t offsets[height];  // int32 offset of each group's first block
+    int32_t l, first = 0;
+    size_t  size = 0;
+
+    for (l = 0; l < height; l++) {
+        blocked_level *lv = &bt->levels[l];
+        size_t length = tree->fanouts[l] - 1;
+        lv->fanout = tree->fanouts[l];
+
+        if (l > first) {
+            // stay in the group while the grown block still fits
+            size_t nodes = per_block[l - 1] * tree->fanouts[l - 1];
+            size_t keys  = bt->levels[l - 1].offset + per_block[l - 1] * (tree->fanouts[l - 1] - 1);
+            if (sizeof(int32_t) * round_up(keys + nodes * length, line) <= block_bytes) {
+                per_block[l]     = nodes;
+                lv->starts_block = 0;
+                lv->offset       = keys;
+                continue;
+            }
+        }
+        first            = l;
+        per_block[l]     = 1;
+        lv->starts_block = 1;
+        lv->offset       = 0;
+        bt->num_groups++;
+    }
+
+    // a group holds one block per node of its first level the search can reach
+    for (l = 0; l < height; l++) {
+        blocked_level *lv = &bt->levels[l];
+        if (!lv->starts_block)
+            continue;
+        int32_t last = l;
+        while (last + 1 < height && !bt->levels[last + 1].starts_block)
+            last++;
+
+        size_t stride = round_up(bt->levels[last].offset +
+                                 per_block[last] * (bt->levels[last].fanout - 1), line);
+        size_t num_blocks = tree->level_sizes[l] / (lv->fanout - 1);
+        int32_t k;
+        for (k = l; k <= last; k++)
+            bt->levels[k].stride = stride;
+        offsets[l] = size;
+        size += stride * num_blocks;
+    }
+
+    bt->size = sizeof(int32_t) * size;
+    if (posix_memalign(&bt->arena, TREE_NODE_ALIGN, bt->size ? bt->size : TREE_NODE_ALIGN)) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+
+    // block slots no reachable node fills are padding
+    int32_t *arena = bt->arena;
+    size_t i;
+    for (i = 0; i < size; i++)
+        arena[i] = INT32_MAX;
+
+    int32_t *blocks = NULL;
+    for (l = 0; l < height; l++) {
+        blocked_level *lv = &bt->levels[l];
+        if (lv->starts_block)
+            blocks = arena + offsets[l];
+        lv->blocks = blocks;
+
+        // node n of the level is node n % per_block of block n / per_block
+        size_t length = lv->fanout - 1;
+        size_t n, num_nodes = tree->level_sizes[l] / length;
+        for (n = 0; n < num_nodes; n++) {
+            int32_t *dst = blocks + n / per_block[l] * lv->stride + lv->offset +
+                           n % per_block[l] * length;
+            const int32_t *src = tree->nodes[l] + n * length;
+            assert(dst + length <= arena + size);
+            for (i = 0; i < length; i++)
+                dst[i] = src[i];
+        }
+    }
+}
+
+int32_t blocked_search_partition(blocked_tree *bt, int32_t probe) {
+    const int32_t *block = NULL;
+    int32_t range = 0, local = 0;  // node index in the level, and in the block
+    int32_t l;
+    for (l = 0; l < bt->num_levels; l++) {
+        const blocked_level *lv = &bt->levels[l];
+        int32_t length = lv->fanout - 1;
+        if (lv->starts_block) {
+            block = lv->blocks + (size_t) range * lv->stride;
+            local = 0;
+        }
+        int32_t res = node_rank(block + lv->offset + (size_t) local * length, length, probe);
+        range = range * lv->fanout + res;
+        local = local * lv->fanout + res;
+    }
+    return range;
+}
+
+// one probe's step down one level; length is a constant in the unrolled cases
+#define LEVEL_STEP(lv, length, probe, block, range, local)                      \
+    do {                                                                        \
+        if ((lv)->starts_block) {                                               \
+            block = (lv)->blocks + (size_t) range * (lv)->stride;               \
+            local = 0;                                                          \
+        }                                                                       \
+        int32_t res = node_rank(block + (lv)->offset + (size_t) local * (length), \
+                                length, probe);                                 \
+        range = range * (lv)->fanout + res;                                     \
+        local = local * (lv)->fanout + res;                                     \
+    } while (0)
+
+// one level lv for all 4 interleaved probes, so their loads overlap
+#define LEVEL_STEP4(length)                                                     \
+    do {                                                                        \
+        LEVEL_STEP(lv, length, probes[i+0], block1, range1, local1);            \
+        LEVEL_STEP(lv, length, probes[i+1], block2, range2, local2);            \
+        LEVEL_STEP(lv, length, probes[i+2], block3, range3, local3);            \
+        LEVEL_STEP(lv, length, probes[i+3], block4, range4, local4);            \
+    } while (0)
+
+void blocked_search_partition_batch(blocked_tree *bt, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges) {
+    size_t i;
+    int32_t l;
+    for (i = 0; i + 3 < num_probes; i += 4) {
+        const int32_t *block1 = NULL, *block2 = NULL, *block3 = NULL, *block4 = NULL;
+        int32_t range1 = 0, range2 = 0, range3 = 0, range4 = 0;
+        int32_t local1 = 0, local2 = 0, local3 = 0, local4 = 0;
+
+        for (l = 0; l < bt->num_levels; l++) {
+            const blocked_level *lv = &bt->levels[l];
+            SWITCH_NODE_LENGTH(lv->fanout, LEVEL_STEP4);
+        }
+
+        ranges[i+0] = range1;
+        ranges[i+1] = range2;
+        ranges[i+2] = range3;
+        ranges[i+3] = range4;
+    }
+
+    // remaining 0-3 probes, one at a time
+    for (; i < num_probes; i++)
+        ranges[i] = blocked_search_partition(bt, probes[i]);
+}
+
+#undef LEVEL_STEP
+#undef LEVEL_STEP4
+
+void destroy_blocked_tree(blocked_tree *bt) {
+    free(bt->levels);
+    free(bt->arena);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// blocked layout of a partition tree (in the style of FAST)
+//
+// partition_tree keeps each level in its own array, so a search touches
+// one unrelated region per level. Here consecutive levels are grouped so
+// that a node and all of its descendants within the group, a block, fit in
+// block_bytes (a page by default). A block's nodes are stored together,
+// level by level, so its top nodes share cache lines and a search touches
+// one block per group instead of one region per level. The blocks of a
+// group are stored in the order of their root nodes, so the ranges are the
+// same as those of the source tree.
+
+// default block size, a 4KB page
+#define BLOCKED_DEFAULT_BYTES 4096
+
+typedef struct {
+    int32_t  fanout;
+    int32_t  starts_block;  // first level of its group, a search enters a new block
+    size_t   offset;        // int32 offset of the level's nodes in a block
+    size_t   stride;        // int32 slots per block of the level's group
+    int32_t *blocks;        // first block of the level's group
+} blocked_level;
+
+typedef struct {
+    int32_t        num_levels;
+    int32_t        num_keys;
+    int32_t        num_groups;
+    blocked_level *levels;
+    size_t         size;    // bytes of the arena
+    void          *arena;
+} blocked_tree;
+
+/**
+ * copies tree into the blocked layout, grouping levels greedily from the
+ * root so that each block (rounded to TREE_NODE_ALIGN) fits in
+ * block_bytes, with at least one level per group; the source tree is not
+ * modified and can be destroyed independently
+ */
+void init_blocked_tree(partition_tree *tree, size_t block_bytes, blocked_tree *bt);
+
+/**
+ * partition of one probe, any fanouts
+ */
+int32_t blocked_search_partition(blocked_tree *bt, int32_t probe);
+
+/**
+ * partitions of num_probes probes, 4 interleaved per level; the ranges
+ * are the ones binary_search_partition_batch returns for the source tree
+ */
+void blocked_search_partition_batch(blocked_tree *bt, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges);
+
+/**
+ * frees all resources associated with the given blocked tree
+ */
+void destroy_blocked_tree(blocked_tree *bt);
@@ -1,24 +1,477 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "tree.h"
 #include "random.h"
+#include "parallel.h"
+#include "partition.h"
+#include "output.h"
+#include "stream.h"
+#include "tree_file.h"
+#include "numa.h"
+#include "typed_tree.h"
+#include "updatable.h"
+#include "fastrand.h"
+#include "verify.h"
+#include "blocked_tree.h"
+#include "compressed_tree.h"
+#include "radix_table.h"
+#include "learned_index.h"
+#include "tune.h"
+#include "util.h"
 
 #define NUM_EXPERIMENTS 1
 
-// verifies that the resulting range of a probe is correct
-void verify_probe(int32_t num_keys, int32_t *keys, int32_t probe, int32_t range);
+// keys and probes come from the provided generator, or with -F from the
+// multithreaded one (fastrand.h)
+typedef struct {
+    rand32_t   *mt;
+    fastrand_t *fast;
+} key_source;
+
+static int32_t *source_keys(key_source *src, size_t n) {
+    return src->fast ? fastrand_generate_sorted_unique(n, src->fast)
+                     : generate_sorted_unique(n, src->mt);
+}
+
+static int32_t *source_probes(key_source *src, size_t n) {
+    return src->fast ? fastrand_generate(n, src->fast) : generate(n, src->mt);
+}
+
+// search options shared by the in-memory and streaming drivers
+typedef struct {
+    partition_tree *tree;
+    int32_t         num_threads;
+    int32_t         group_size;
+    thread_stats   *stats;
+    double          parallel_elapsed;
+    numa_trees     *numa;  // per-node replicas searched instead of tree, or NULL
+    updatable_tree *updatable;  // snapshots searched instead of tree, or NULL
+    blocked_tree   *blocked;    // blocked copy searched instead of tree, or NULL
+    compressed_tree *compressed;  // compressed copy searched instead of tree, or NULL
+    radix_table    *radix;      // jump table replacing the top levels, or NULL
+    learned_index  *learned;    // models searched instead of tree, or NULL
+    int32_t         per_probe;  // 1: scalar, 2: SIMD search one probe at a time, 0: batched
+} search_config;
+
+// where the results go
+typedef struct {
+    int32_t  output;
+    int      fd;
+    uint64_t checksum;
+} result_sink;
+
+static void search_probes(search_config *c, size_t num_probes, int32_t *probes, int32_t *ranges) {
+    partition_tree *tree = c->tree;
+
+    if (c->updatable) {
+        // a fresh snapshot per chunk, so concurrent updates show up as they land
+        size_t i;
+        for (i = 0; i < num_probes; i += PARALLEL_CHUNK_PROBES) {
+            size_t n = num_probes - i < PARALLEL_CHUNK_PROBES ? num_probes - i
+                                                               : PARALLEL_CHUNK_PROBES;
+            tree_snapshot *snapshot = acquire_snapshot(c->updatable);
+            snapshot_search(snapshot, n, probes + i, ranges + i);
+            release_snapshot(snapshot);
+        }
+    } else if (c->blocked) {
+        // same ranges, one block per group of levels instead of one region per level
+        blocked_search_partition_batch(c->blocked, num_probes, probes, ranges);
+    } else if (c->compressed) {
+        // same ranges, lower levels searched with 16-bit or 8-bit compares
+        compressed_search_partition_batch(c->compressed, num_probes, probes, ranges);
+    } else if (c->radix) {
+        // top levels looked up by the probe's high bits
+        radix_search_partition_batch(tree, c->radix, num_probes, probes, ranges);
+    } else if (c->learned) {
+        // position predicted from the keys, corrected by a bounded scan
+        learned_search_partition_batch(c->learned, num_probes, probes, ranges);
+    } else if (c->num_threads > 0) {
+        // probes split into chunks over the threads, tree shared read-only;
+        // stats add up over the chunks of a stream
+        thread_stats stats[c->num_threads];
+        int32_t t;
+        if (c->numa)
+            c->parallel_elapsed += numa_search_partition(c->numa, num_probes, probes, ranges,
+                                                         c->group_size, c->num_threads, stats);
+        else
+            c->parallel_elapsed += parallel_search_partition(tree, num_probes, probes, ranges,
+                                                             c->group_size, c->num_threads,
+                                                             stats);
+        for (t = 0; t < c->num_threads; t++) {
+            c->stats[t].num_items  += stats[t].num_items;
+            c->stats[t].num_chunks += stats[t].num_chunks;
+            c->stats[t].num_stolen += stats[t].num_stolen;
+            c->stats[t].elapsed    += stats[t].elapsed;
+        }
+    } else if (c->group_size > 0) {
+        // prefetching search with group_size probes in flight
+        binary_search_partition_amac(tree, num_probes, probes, ranges, c->group_size);
+    } else if (c->per_probe) {
+        // the unbatched searches, scalar or SIMD per node
+        size_t i;
+        for (i = 0; i < num_probes; i++) {
+            if (c->per_probe == 1)
+                binary_search_partition(tree, probes[i], &ranges[i]);
+            else
+                binary_search_partition_simd(tree, probes[i], &ranges[i]);
+        }
+    } else {
+        // hard-coded 9-5-9 tree, generated kernel for this fanout tuple or
+        // the interleaved search for any other fanouts, chunk by chunk
+        binary_search_partition_lookup(tree, num_probes, probes, ranges);
+    }
+}
+
+static void write_results(result_sink *sink, size_t num_probes,
+                          const int32_t *probes, const int32_t *ranges) {
+    size_t i;
+    switch (sink->output) {
+    case OUTPUT_PRINTF:
+        for (i = 0; i < num_probes; i++) {
+            printf("%d %d\n", probes[i], ranges[i]);
+        }
+        break;
+    case OUTPUT_TEXT:
+        write_text_output(sink->fd, num_probes, probes, ranges);
+        break;
+    case OUTPUT_BINARY:
+        write_binary_output(sink->fd, num_probes, ranges);
+        break;
+    case OUTPUT_CHECKSUM:
+        sink->checksum = checksum_ranges(sink->checksum, num_probes, ranges);
+        break;
+    default:
+        // mmap: the search already wrote into the file
+        break;
+    }
+}
+
+// builds a tree over another key type from the generated int32 keys and
+// probes, mapped with keys_from_int32, and searches it; ranges as for int32;
+// with mismatches, also checks the ranges against the mapped keys
+#define SEARCH_TYPED(name, key_t) {                                                 \
+        key_t *typed_keys   = malloc(sizeof(key_t) * (num_keys > 0 ? num_keys : 1));   \
+        key_t *typed_probes = malloc(sizeof(key_t) * (num_probes > 0 ? num_probes : 1)); \
+        int32_t n = keys_from_int32_##name(num_keys, keys, typed_keys, 1);              \
+        keys_from_int32_##name(num_probes, probes, typed_probes, 0);                  \
+        partition_tree_##name tree;                                                   \
+        init_partition_tree_##name(n, typed_keys, num_levels, fanouts, &tree);        \
+        double start = now();                                                         \
+        binary_search_partition_batch_##name(&tree, num_probes, typed_probes, ranges); \
+        elapsed = (now() - start) * 1000;                                             \
+        if (mismatches)                                                               \
+            *mismatches = verify_ranges_##name(n, typed_keys, num_probes, typed_probes, \
+                                               ranges, verify_sample, num_checked);   \
+        destroy_partition_tree_##name(&tree);                                         \
+        free(typed_keys);                                                             \
+        free(typed_probes);                                                           \
+    }
+
+// returns the search time in milliseconds
+static double search_typed(int32_t type, int32_t num_keys, const int32_t *keys,
+                           int32_t num_levels, int32_t *fanouts, size_t num_probes,
+                           const int32_t *probes, int32_t *ranges, size_t verify_sample,
+                           size_t *mismatches, size_t *num_checked) {
+    double elapsed = 0.0;
+    switch (type) {
+    case KEY_INT64: SEARCH_TYPED(i64, int64_t); break;
+    case KEY_INT16: SEARCH_TYPED(i16, int16_t); break;
+    case KEY_FLOAT: SEARCH_TYPED(f32, float);   break;
+    default: break;
+    }
+    return elapsed;
+}
+
+// shifts randomly chosen delimiters by a small amount while probes run,
+// each shift a delete and an insert
+typedef struct {
+    updatable_tree *tree;
+    int32_t        *keys;       // current delimiters, sorted
+    int32_t         num_keys;
+    int32_t         num_shifts;
+    uint32_t        seed;
+    size_t          num_retries;  // updates retried while the delta was full
+    double          elapsed;
+} update_job;
+
+// returns 0, or -1 if the update failed for good
+static int update_until_done(update_job *job, int32_t key, int32_t insert) {
+    while ((insert ? updatable_tree_insert(job->tree, key)
+                   : updatable_tree_delete(job->tree, key)) < 0) {
+        if (errno != EAGAIN) {
+            fprintf(stderr, "error: %s of delimiter %d: %s\n", insert ? "insert" : "delete",
+                    key, strerror(errno));
+            return -1;
+        }
+        // the delta is full, wait for the merge thread
+        job->num_retries++;
+        sched_yield();
+    }
+    return 0;
+}
+
+static void *update_main(void *arg) {
+    update_job *job = arg;
+    rand32_t   *gen = rand32_init(job->seed);
+    int32_t i;
+
+    double start = now();
+    for (i = 0; i < job->num_shifts; i++) {
+        int32_t  k     = rand32_next(gen) % job->num_keys;
+        int64_t  lo    = k > 0 ? job->keys[k-1] + 1 : INT32_MIN;
+        int64_t  hi    = k < job->num_keys - 1 ? job->keys[k+1] - 1 : INT32_MAX - 1;
+        int64_t  moved = job->keys[k] + (int32_t) (rand32_next(gen) % 2049) - 1024;
+        if (moved < lo)
+            moved = lo;
+        if (moved > hi)
+            moved = hi;
+        if (moved == job->keys[k])
+            continue;
+
+        if (update_until_done(job, job->keys[k], 0) < 0)
+            break;
+        job->keys[k] = moved;
+        if (update_until_done(job, moved, 1) < 0) {
+            // the old delimiter is gone, the updater's copy must not list either
+            memmove(job->keys + k, job->keys + k + 1, sizeof(int32_t) * (job->num_keys - k - 1));
+            job->num_keys--;
+            break;
+        }
+    }
+
+    job->elapsed = (now() - start) * 1000;
+    free(gen);
+    return NULL;
+}
+
+typedef struct {
+    search_config *search;
+    result_sink   *sink;
+    int32_t       *ranges;
+} stream_job;
+
+static void search_chunk(void *ctx, size_t num_probes, const int32_t *probes) {
+    stream_job *job = ctx;
+    search_probes(job->search, num_probes, (int32_t *) probes, job->ranges);
+    write_results(job->sink, num_probes, probes, job->ranges);
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [-t <num threads>] [-g <amac group size>] [-p | -P]\n"
+           "          [-o printf|text|binary|mmap|none] [-f <output file>]\n"
+           "          [-i <probe file, - for stdin>] [-s <seed>] [-S <tree file>]\n"
+           "          [-A] [-H 2m|1g] [-N] [-T int32|int64|int16|float] [-u <num shifts>] [-R]\n"
+           "          [-F <generator threads>] [-V <sample, 0 for all probes>] [-B <block bytes>]\n"
+           "          [-C 8|16|32] [-J <jump table bits, 0 for auto>]\n"
+           "          [-M <learned segments, 0 for auto>] [-Q <interval width>] [-D]\n"
+           "          [-b scalar|simd]\n"
+           "          <num keys> <num probes> <list of fanout parameters...>\n"
+           "       %s [options] -a <tune file, - for none> <num keys> <num probes>\n"
+           "       %s [options] -L <tree file> <num probes>\n", prog, prog, prog);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 4) {
-        printf("usage: %s <num keys> <num probes> <list of fanout parameters...>\n", argv[0]);
+    // 0: search on the main thread, otherwise spread probes over this many threads
+    int32_t num_threads = 0;
+    // 0: batched kernels, otherwise AMAC with this many probes in flight
+    int32_t group_size = 0;
+    // -p: partition the probes, -P: also carry each probe's row id as payload
+    int32_t partition_mode = 0;
+    // how results are written, and where for the text and binary modes
+    int32_t output = OUTPUT_PRINTF;
+    const char *output_path = NULL;
+    // probes streamed from this file instead of generated
+    const char *input_path = NULL;
+    // seed for key and probe generation, the current time by default
+    uint32_t seed = time(NULL);
+    // tree written to / mapped from this file
+    const char *save_path = NULL;
+    const char *load_path = NULL;
+    // -a: fanouts picked by benchmarking shapes, and recorded in this file
+    const char *tune_path = NULL;
+    int32_t     tune = 0;
+    // -A: all levels in one trimmed arena, -H: backed by huge pages
+    int32_t alloc_flags = 0;
+    // -N: one tree replica per NUMA node, threads pinned to the nodes
+    int32_t numa_mode = 0;
+    // key type of the tree, other than int32 it is built from mapped int32 keys
+    int32_t key_type = KEY_INT32;
+    // delimiters shifted by a concurrent updater while the probes run
+    int32_t num_shifts = 0;
+    // -R: sort the probes and emit one (range, end) run per range
+    int32_t sorted_mode = 0;
+    // -Q: each probe p is the interval [p, p + width], -1 for point probes
+    int32_t interval_width = -1;
+    // -D: only count the probes per range and print the skew, no per-probe output
+    int32_t histogram_mode = 0;
+    // 0: provided generator, otherwise the multithreaded one on this many threads
+    int32_t gen_threads = 0;
+    // -V: check the ranges of this many probes against the keys, 0 for all
+    int32_t verify = 0;
+    size_t  verify_sample = 0;
+    size_t  num_mismatches = 0;
+    size_t  num_checked = 0;
+    // -B: search a blocked copy of the tree with blocks of at most this many bytes
+    size_t  block_bytes = 0;
+    // -C: search a copy with levels compressed down to this many bits per delimiter
+    int32_t min_width = 0;
+    // -J: jump table over the top levels with 2^bits buckets, -1 for none
+    int32_t radix_bits = -1;
+    // -M: learned index with this many segments, 0 for auto, -1 for none
+    int32_t num_segments = -1;
+    // -b: 1 for the scalar, 2 for the SIMD search one probe at a time
+    int32_t per_probe = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:g:pPo:f:i:s:S:L:a:AH:NT:u:RQ:DF:V:B:C:J:M:b:")) != -1) {
+        switch (opt) {
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'g':
+            group_size = atoi(optarg);
+            break;
+        case 'p':
+            partition_mode = 1;
+            break;
+        case 'P':
+            partition_mode = 2;
+            break;
+        case 'o':
+            output = parse_output_mode(optarg);
+            if (output < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            output_path = optarg;
+            break;
+        case 'i':
+            input_path = optarg;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            save_path = optarg;
+            break;
+        case 'L':
+            load_path = optarg;
+            break;
+        case 'a':
+            tune = 1;
+            tune_path = strcmp(optarg, "-") == 0 ? NULL : optarg;
+            break;
+        case 'A':
+            alloc_flags |= TREE_ALLOC_ARENA;
+            break;
+        case 'N':
+            numa_mode = 1;
+            break;
+        case 'u':
+            num_shifts = atoi(optarg);
+            break;
+        case 'R':
+            sorted_mode = 1;
+            break;
+        case 'Q':
+            interval_width = atoi(optarg);
+            if (interval_width < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'D':
+            histogram_mode = 1;
+            break;
+        case 'F':
+            gen_threads = atoi(optarg);
+            break;
+        case 'V':
+            verify = 1;
+            verify_sample = strtoul(optarg, NULL, 10);
+            break;
+        case 'B':
+            block_bytes = strtoul(optarg, NULL, 10);
+            if (block_bytes == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            min_width = atoi(optarg);
+            if (min_width != 8 && min_width != 16 && min_width != 32) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'J':
+            radix_bits = atoi(optarg);
+            if (radix_bits < 0 || radix_bits > RADIX_MAX_BITS) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'M':
+            num_segments = atoi(optarg);
+            if (num_segments < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            key_type = parse_key_type(optarg);
+            if (key_type < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            if (strcmp(optarg, "scalar") == 0) {
+                per_probe = 1;
+            } else if (strcmp(optarg, "simd") == 0) {
+                per_probe = 2;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'H':
+            if (strcmp(optarg, "2m") == 0) {
+                alloc_flags |= TREE_ALLOC_HUGE_2MB;
+            } else if (strcmp(optarg, "1g") == 0) {
+                alloc_flags |= TREE_ALLOC_HUGE_1GB;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // a loaded tree brings its own keys and fanouts, a tuned one picks them
+    if (argc - optind < (load_path ? 1 : tune ? 2 : 3)) {
+        usage(argv[0]);
         return 1;
     }
-    
-    int32_t num_keys   = atoi(argv[1]);
-    int32_t num_probes = atoi(argv[2]);
+
+    int32_t num_keys   = load_path ? 0 : atoi(argv[optind]);
+    int32_t num_probes = atoi(argv[load_path ? optind : optind+1]);
 
     if (num_keys < 0) {
         printf("error: number of keys should be positive\n");
@@ -29,56 +482,521 @@ int main(int argc, char *argv[]) {
         printf("error: number of probes should be positive\n");
         return 1;
     }
+
+    if (num_threads < 0) {
+        printf("error: number of threads should be positive\n");
+        return 1;
+    }
+
+    if (group_size < 0 || group_size > AMAC_MAX_GROUP) {
+        printf("error: amac group size should be between 0 (off) and %d\n", AMAC_MAX_GROUP);
+        return 1;
+    }
+
+    if (key_type != KEY_INT32 &&
+        (num_threads || group_size || partition_mode || input_path || save_path ||
+         load_path || alloc_flags || numa_mode ||
+         output == OUTPUT_PRINTF || output == OUTPUT_TEXT)) {
+        printf("error: -T only supports -o binary|mmap|none, -s and -V\n");
+        return 1;
+    }
+
+    if (verify && (partition_mode || input_path)) {
+        printf("error: -V doesn't support -p, -P or -i\n");
+        return 1;
+    }
+
+    if (gen_threads < 0) {
+        printf("error: number of generator threads should be positive\n");
+        return 1;
+    }
+
+    if (num_shifts < 0) {
+        printf("error: number of shifts should be positive\n");
+        return 1;
+    }
+
+    if (num_shifts && (num_threads || group_size || partition_mode || input_path || numa_mode)) {
+        printf("error: -u doesn't support -t, -g, -p, -P, -i or -N\n");
+        return 1;
+    }
+
+    if (sorted_mode && (num_threads || group_size || partition_mode || input_path ||
+                        numa_mode || num_shifts ||
+                        (output != OUTPUT_PRINTF && output != OUTPUT_CHECKSUM))) {
+        printf("error: -R only supports -o printf|none and no other search options\n");
+        return 1;
+    }
+
+    if (interval_width >= 0 && (num_threads || group_size || partition_mode || input_path ||
+                                numa_mode || num_shifts || sorted_mode || block_bytes ||
+                                min_width || radix_bits >= 0 || num_segments >= 0 ||
+                                (output != OUTPUT_PRINTF && output != OUTPUT_CHECKSUM))) {
+        printf("error: -Q only supports -o printf|none and no other search options\n");
+        return 1;
+    }
+
+    if (histogram_mode && (partition_mode || input_path || numa_mode || num_shifts ||
+                           sorted_mode || interval_width >= 0 || block_bytes || min_width ||
+                           radix_bits >= 0 || num_segments >= 0 || key_type != KEY_INT32 ||
+                           (output != OUTPUT_PRINTF && output != OUTPUT_CHECKSUM))) {
+        printf("error: -D only supports -t, -g, -o printf|none and no other search options\n");
+        return 1;
+    }
+
+    if (block_bytes && (num_threads || group_size || partition_mode || numa_mode ||
+                        num_shifts || sorted_mode || key_type != KEY_INT32)) {
+        printf("error: -B doesn't support -t, -g, -p, -P, -N, -u, -R or -T\n");
+        return 1;
+    }
+
+    if (min_width && (block_bytes || num_threads || group_size || partition_mode ||
+                      numa_mode || num_shifts || sorted_mode || key_type != KEY_INT32)) {
+        printf("error: -C doesn't support -B, -t, -g, -p, -P, -N, -u, -R or -T\n");
+        return 1;
+    }
+
+    if (radix_bits >= 0 && (block_bytes || min_width || num_threads || group_size ||
+                            partition_mode || numa_mode || num_shifts || sorted_mode ||
+                            key_type != KEY_INT32)) {
+        printf("error: -J doesn't support -B, -C, -t, -g, -p, -P, -N, -u, -R or -T\n");
+        return 1;
+    }
+
+    if (num_segments >= 0 && (block_bytes || min_width || radix_bits >= 0 || num_threads ||
+                              group_size || partition_mode || numa_mode || num_shifts ||
+                              sorted_mode || key_type != KEY_INT32)) {
+        printf("error: -M doesn't support -B, -C, -J, -t, -g, -p, -P, -N, -u, -R or -T\n");
+        return 1;
+    }
+
+    if (per_probe && (num_threads || group_size || partition_mode || numa_mode || num_shifts ||
+                      sorted_mode || interval_width >= 0 || histogram_mode || block_bytes ||
+                      min_width || radix_bits >= 0 || num_segments >= 0 ||
+                      key_type != KEY_INT32)) {
+        printf("error: -b doesn't support -t, -g, -p, -P, -N, -u, -R, -Q, -D, -B, -C, -J, -M or -T\n");
+        return 1;
+    }
+
+    if (numa_mode && partition_mode) {
+        printf("error: numa mode doesn't support -p or -P\n");
+        return 1;
+    }
+
+    if (input_path && (partition_mode || output == OUTPUT_MMAP)) {
+        printf("error: streamed input doesn't support -p, -P or mmap output\n");
+        return 1;
+    }
+
+    if ((output == OUTPUT_BINARY || output == OUTPUT_MMAP) && !output_path) {
+        printf("error: binary and mmap output need an output file (-f)\n");
+        return 1;
+    }
+
+    if (partition_mode && output != OUTPUT_PRINTF && output != OUTPUT_CHECKSUM) {
+        printf("error: partitioned output only supports printf and none\n");
+        return 1;
+    }
     
-    int32_t num_levels = argc - 3;
+    if (tune && (load_path || key_type != KEY_INT32)) {
+        printf("error: -a doesn't support -L or -T\n");
+        return 1;
+    }
+
+    int32_t num_levels = load_path ? 1 : tune ? TUNE_MAX_LEVELS : argc - optind - 2;
     int32_t fanouts[num_levels];
     size_t  i;
-    for (i = 0; i != num_levels; i++) {
-        fanouts[i] = atoi(argv[i+3]);
+    for (i = 0; i != num_levels && !load_path && !tune; i++) {
+        fanouts[i] = atoi(argv[optind+2+i]);
     }
 
-    // generate keys
-    rand32_t *gen  = rand32_init(time(NULL));
-    int32_t  *keys = generate_sorted_unique(num_keys, gen);
-    
-    // build the partition tree
+    key_source gen = { rand32_init(seed), gen_threads ? fastrand_init(seed, gen_threads) : NULL };
+    int32_t   *keys = NULL;
     partition_tree tree;
-    init_partition_tree(num_keys, keys, num_levels, fanouts, &tree);
+
+    if (key_type != KEY_INT32) {
+        result_sink sink = { output, -1, CHECKSUM_INIT };
+        if (output == OUTPUT_BINARY)
+            sink.fd = open_output_file(output_path);
+
+        keys = source_keys(&gen, num_keys);
+        int32_t *probes = source_probes(&gen, num_probes);
+        int32_t *ranges = output == OUTPUT_MMAP ? map_ranges_file(output_path, num_probes)
+                                                : malloc(num_probes * sizeof(int32_t));
+
+        double elapsed = search_typed(key_type, num_keys, keys, num_levels, fanouts,
+                                      num_probes, probes, ranges, verify_sample,
+                                      verify ? &num_mismatches : NULL, &num_checked);
+        write_results(&sink, num_probes, probes, ranges);
+        if (output == OUTPUT_CHECKSUM)
+            printf("checksum: %016llx\n", (unsigned long long) sink.checksum);
+        printf("search time: %.3f milliseconds\n", elapsed);
+        if (verify)
+            printf("verified %zu probes: %zu mismatches\n", num_checked, num_mismatches);
+
+        if (output == OUTPUT_MMAP)
+            unmap_ranges_file(ranges, num_probes);
+        else
+            free(ranges);
+        if (sink.fd > STDOUT_FILENO)
+            close(sink.fd);
+        free(probes);
+        free(gen.mt);
+        free(gen.fast);
+        free(keys);
+        return num_mismatches > 0;
+    }
+
+    if (load_path) {
+        // map a saved tree instead of generating keys and building it
+        if (load_partition_tree(load_path, &tree) < 0) {
+            perror(load_path);
+            return 1;
+        }
+        num_keys = tree.num_keys;
+        if (verify) {
+            // the keys to check against come back out of the tree
+            keys = malloc(sizeof(int32_t) * num_keys);
+            partition_tree_keys(&tree, keys);
+        }
+    } else {
+        // generate keys
+        // wall time, clock() would add up the CPU time of all generator threads
+        double start = now();
+        keys = source_keys(&gen, num_keys);
+        if (gen_threads)
+            printf("generated %d keys in %.3f milliseconds\n", num_keys,
+                   (now() - start) * 1000);
+
+        if (tune) {
+            cache_topology topo;
+            read_cache_topology(&topo);
+            print_cache_topology(&topo);
+            num_levels = tune_fanouts(num_keys, keys, &topo, tune_path, fanouts);
+            if (num_levels < 0) {
+                printf("error: no fanouts up to %d levels fit %d keys\n", TUNE_MAX_LEVELS,
+                       num_keys);
+                return 1;
+            }
+        }
+
+        // build the partition tree
+        init_partition_tree_alloc(num_keys, keys, num_levels, fanouts, alloc_flags, &tree);
+    }
+
+    if (alloc_flags) {
+        size_t bytes = 0;
+        for (i = 0; i < tree.num_levels; i++)
+            bytes += sizeof(int32_t) * partition_tree_level_size(&tree, i);
+        printf("tree: %zu bytes of nodes in one arena, %s pages\n", bytes,
+               tree.alloc_flags & TREE_ALLOC_HUGE_1GB ? "1GB huge" :
+               tree.alloc_flags & TREE_ALLOC_HUGE_2MB ? "2MB huge" :
+               tree.alloc_flags & TREE_ALLOC_THP      ? "transparent huge" : "4KB");
+    }
     /* print_partition_tree(&tree); */
 
+    if (save_path && save_partition_tree(&tree, save_path) < 0) {
+        perror(save_path);
+        return 1;
+    }
+
+    numa_trees numa;
+    if (numa_mode) {
+        // default to one worker per cpu of every node
+        init_numa_trees(&tree, &numa);
+        if (num_threads == 0)
+            for (i = 0; i < numa.num_nodes; i++)
+                num_threads += numa.num_cpus[i];
+    }
+
+    blocked_tree blocked;
+    if (block_bytes) {
+        init_blocked_tree(&tree, block_bytes, &blocked);
+        printf("blocked: %zu bytes, %d blocked groups of levels\n", blocked.size,
+               blocked.num_groups);
+    }
+
+    compressed_tree compressed;
+    if (min_width) {
+        init_compressed_tree(&tree, min_width, &compressed);
+        printf("compressed: %zu bytes, level widths", compressed.size);
+        for (i = 0; i < compressed.num_levels; i++)
+            printf(" %d", compressed.levels[i].width);
+        printf("\n");
+    }
+
+    radix_table radix;
+    if (radix_bits >= 0) {
+        double resolved;
+        init_radix_table(&tree, radix_bits, &radix);
+        double skipped = radix_table_skipped_levels(&tree, &radix, &resolved);
+        printf("jump table: %d bits, %.2f levels skipped per bucket, %.1f%% of buckets resolved\n",
+               radix.bits, skipped, resolved * 100);
+    }
+
+    learned_index learned;
+    if (num_segments >= 0) {
+        init_learned_index(&tree, num_segments, LEARNED_MAX_ERROR, &learned);
+        print_learned_index_stats(&learned);
+    }
+
+    thread_stats  stats[num_threads > 0 ? num_threads : 1];
+    memset(stats, 0, sizeof(stats));
+    search_config search = { &tree, num_threads, group_size, stats, 0.0,
+                             numa_mode ? &numa : NULL, NULL,
+                             block_bytes ? &blocked : NULL,
+                             min_width ? &compressed : NULL,
+                             radix_bits >= 0 ? &radix : NULL,
+                             num_segments >= 0 ? &learned : NULL, per_probe };
+
+    // the updatable tree takes over the tree, the updater works on a copy
+    // of its delimiters
+    updatable_tree updatable;
+    update_job     updater;
+    pthread_t      update_thread;
+    if (num_shifts) {
+        updater = (update_job) { &updatable, malloc(sizeof(int32_t) * num_keys), num_keys,
+                                 num_shifts, seed + 1, 0, 0.0 };
+        partition_tree_keys(&tree, updater.keys);
+        init_updatable_tree(&tree, &updatable);
+        search.updatable = &updatable;
+        if (pthread_create(&update_thread, NULL, update_main, &updater)) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    result_sink   sink   = { output, -1, CHECKSUM_INIT };
+    if (output == OUTPUT_TEXT || output == OUTPUT_BINARY)
+        sink.fd = open_output_file(output_path);
+    fflush(stdout);
+
+    if (input_path) {
+        // bounded memory: one chunk of ranges, STREAM_BUFFERS chunks of probes
+        stream_job   job = { &search, &sink, malloc(sizeof(int32_t) * STREAM_CHUNK_PROBES) };
+        stream_stats st;
+        if (stream_probes(input_path, STREAM_CHUNK_PROBES, num_probes, search_chunk, &job, &st) < 0)
+            return 1;
+
+        if (output == OUTPUT_CHECKSUM)
+            printf("checksum: %016llx\n", (unsigned long long) sink.checksum);
+        if (num_threads > 0)
+            print_thread_stats(stats, num_threads, search.parallel_elapsed);
+        if (numa_mode)
+            print_numa_stats(&numa, stats, num_threads);
+        printf("streamed %zu probes in %zu chunks: %.3f milliseconds, %.3f milliseconds waiting for input\n",
+               st.num_probes, st.num_chunks, st.elapsed * 1000, st.io_wait * 1000);
+
+        free(job.ranges);
+        if (sink.fd > STDOUT_FILENO)
+            close(sink.fd);
+        if (numa_mode)
+            destroy_numa_trees(&numa);
+        if (block_bytes)
+            destroy_blocked_tree(&blocked);
+        if (min_width)
+            destroy_compressed_tree(&compressed);
+        if (radix_bits >= 0)
+            destroy_radix_table(&radix);
+        if (num_segments >= 0)
+            destroy_learned_index(&learned);
+        destroy_partition_tree(&tree);
+        free(gen.mt);
+        free(gen.fast);
+        free(keys);
+        return 0;
+    }
+
     double elapsed_times[NUM_EXPERIMENTS];
     for (int exp = 0; exp < NUM_EXPERIMENTS; exp++) {
         // generate probes
         // this step is not included in time measurements
-        int32_t *probes = generate(num_probes, gen);
-        int32_t *ranges = malloc(num_probes * sizeof(int32_t));
+        int32_t *probes = source_probes(&gen, num_probes);
+        if (sorted_mode) {
+            int32_t *tmp = malloc(sizeof(int32_t) * num_probes);
+            radix_sort_int32(num_probes, probes, tmp, gen_threads > 0 ? gen_threads : 1);
+            free(tmp);
+        }
+        // with mmap output the search fills the output file in place
+        int32_t *ranges = output == OUTPUT_MMAP ? map_ranges_file(output_path, num_probes)
+                                                : malloc(num_probes * sizeof(int32_t));
+        int32_t *row_ids = NULL;
+        if (partition_mode == 2) {
+            row_ids = malloc(num_probes * sizeof(int32_t));
+            for (i = 0; i < num_probes; i++)
+                row_ids[i] = i;
+        }
 
-        clock_t start = clock();
+        // upper bounds of the intervals, saturated at INT32_MAX
+        int32_t            *his       = NULL;
+        partition_interval *intervals = NULL;
+        if (interval_width >= 0) {
+            his       = malloc(sizeof(int32_t) * num_probes);
+            intervals = malloc(sizeof(partition_interval) * num_probes);
+            for (i = 0; i < num_probes; i++)
+                his[i] = probes[i] > INT32_MAX - interval_width ? INT32_MAX
+                                                                : probes[i] + interval_width;
+        }
 
-        // binary search
-        if (num_levels == 3 && fanouts[0] == 9 && fanouts[1] == 5 && fanouts[2] == 9) {
-            // hard-coded 9-5-9 tree
-            binary_search_partition_959(&tree, num_probes, probes, ranges);
+        partition_output    parts;
+        partition_histogram hist;
+        partition_run   *runs = sorted_mode ? malloc(sizeof(partition_run) * num_probes) : NULL;
+        size_t           num_runs = 0;
+        search.parallel_elapsed = 0.0;
+        memset(stats, 0, sizeof(stats));
+        sink.checksum = CHECKSUM_INIT;
 
-            for (i = 0; i < num_probes; i++) {
-                /* verify_probe(num_keys, keys, probes[i], ranges[i]); */
-                printf("%d %d\n", probes[i], ranges[i]);
-            }
+        // wall time, clock() would add up the CPU time of all search threads
+        double start = now();
+
+        // binary search
+        if (partition_mode) {
+            // move the probes into contiguous per-range output
+            partition_probes(&tree, num_probes, probes, row_ids, &parts);
+        } else if (sorted_mode) {
+            // the path of each probe is reused for the next one
+            num_runs = binary_search_partition_sorted(&tree, num_probes, probes, runs);
+        } else if (histogram_mode) {
+            // per-thread counters, the ranges are never stored
+            search.parallel_elapsed = histogram_probes(&tree, num_probes, probes, group_size,
+                                                       num_threads, stats, &hist);
+        } else if (interval_width >= 0) {
+            // both bounds of an interval share the top of their descent
+            binary_search_partition_intervals(&tree, num_probes, probes, his, intervals);
         } else {
-            int32_t range = -1;
-            for (i = 0; i < num_probes; i++){
-                binary_search_partition_simd(&tree, probes[i], &range);
+            search_probes(&search, num_probes, probes, ranges);
+        }
 
-                // NOTE: comment these out when doing performance tests
-                /* verify_probe(num_keys, keys, probes[i], range); */
-                printf("%d %d\n", probes[i], range);
+        if (sorted_mode) {
+            // one line per range the sorted probes fall into: the range and
+            // the index one past its last probe
+            size_t j;
+            for (j = 0; j < num_runs; j++) {
+                if (output == OUTPUT_PRINTF) {
+                    printf("%d %zu\n", runs[j].range, runs[j].end);
+                } else {
+                    int32_t run[2] = { runs[j].range, (int32_t) runs[j].end };
+                    sink.checksum = checksum_ranges(sink.checksum, 2, run);
+                }
+            }
+            printf("runs: %zu for %d sorted probes\n", num_runs, num_probes);
+            if (verify) {
+                // expanded for the check, untimed below
+                size_t k = 0;
+                for (j = 0; j < num_runs; j++)
+                    for (; k < runs[j].end; k++)
+                        ranges[k] = runs[j].range;
+            }
+            free(runs);
+        } else if (interval_width >= 0) {
+            // one line per interval: its bounds and the first and last range
+            size_t   j, spanned = 0;
+            for (j = 0; j < num_probes; j++) {
+                spanned += intervals[j].last - intervals[j].first + 1;
+                if (output == OUTPUT_PRINTF) {
+                    printf("%d %d %d %d\n", probes[j], his[j], intervals[j].first,
+                           intervals[j].last);
+                } else {
+                    int32_t iv[2] = { intervals[j].first, intervals[j].last };
+                    sink.checksum = checksum_ranges(sink.checksum, 2, iv);
+                }
+            }
+            printf("intervals: %d overlapping %.2f ranges on average\n", num_probes,
+                   num_probes ? spanned / (double) num_probes : 0.0);
+            if (verify) {
+                // last ranges against the upper bounds here, first ranges
+                // against the probes below, untimed
+                for (j = 0; j < num_probes; j++)
+                    ranges[j] = intervals[j].last;
+                size_t mismatches = verify_ranges(num_keys, keys, num_probes, his, ranges,
+                                                  verify_sample, &num_checked);
+                printf("verified %zu interval ends: %zu mismatches\n", num_checked, mismatches);
+                num_mismatches += mismatches;
+                for (j = 0; j < num_probes; j++)
+                    ranges[j] = intervals[j].first;
+            }
+            free(his);
+            free(intervals);
+        } else if (histogram_mode) {
+            // one line per range: the range and the number of probes in it
+            int32_t p;
+            for (p = 0; p < hist.num_partitions; p++) {
+                if (output == OUTPUT_PRINTF) {
+                    printf("%d %zu\n", p, hist.counts[p]);
+                } else {
+                    int32_t count = (int32_t) hist.counts[p];
+                    sink.checksum = checksum_ranges(sink.checksum, 1, &count);
+                }
+            }
+            print_partition_histogram(&hist);
+        } else if (partition_mode) {
+            // output is grouped by range, row ids follow when carried
+            int32_t p;
+            for (p = 0; p < parts.num_partitions && output == OUTPUT_PRINTF; p++) {
+                size_t j;
+                for (j = parts.offsets[p]; j < parts.offsets[p+1]; j++) {
+                    if (row_ids)
+                        printf("%d %d %d\n", parts.keys[j], p, parts.payloads[j]);
+                    else
+                        printf("%d %d\n", parts.keys[j], p);
+                }
             }
+            if (output == OUTPUT_CHECKSUM) {
+                // the partition sizes too: a key placed in a neighbouring
+                // partition can leave the key order unchanged
+                sink.checksum = checksum_ranges(sink.checksum, num_probes, parts.keys);
+                for (p = 0; p < parts.num_partitions; p++) {
+                    int32_t size = (int32_t) (parts.offsets[p+1] - parts.offsets[p]);
+                    sink.checksum = checksum_ranges(sink.checksum, 1, &size);
+                }
+                if (row_ids)
+                    sink.checksum = checksum_ranges(sink.checksum, num_probes, parts.payloads);
+            }
+            destroy_partition_output(&parts);
+        } else {
+            write_results(&sink, num_probes, probes, ranges);
         }
 
-        clock_t end = clock();
-    
-        elapsed_times[exp] = (end - start)/(double)CLOCKS_PER_SEC * 1000;
+        if (output == OUTPUT_CHECKSUM)
+            printf("checksum: %016llx\n", (unsigned long long) sink.checksum);
+
+        if (num_threads > 0)
+            print_thread_stats(stats, num_threads, search.parallel_elapsed);
+        if (numa_mode)
+            print_numa_stats(&numa, stats, num_threads);
+
+        elapsed_times[exp] = (now() - start) * 1000;
+
+        if (verify && histogram_mode) {
+            // the ranges the counts came from, searched again untimed and
+            // counted here
+            binary_search_partition_lookup(&tree, num_probes, probes, ranges);
+            size_t *counts = calloc(hist.num_partitions, sizeof(size_t));
+            size_t  mismatches = 0;
+            int32_t p;
+            for (i = 0; i < num_probes; i++)
+                counts[ranges[i]]++;
+            for (p = 0; p < hist.num_partitions; p++)
+                mismatches += counts[p] != hist.counts[p];
+            printf("verified %d histogram counts: %zu mismatches\n", hist.num_partitions,
+                   mismatches);
+            num_mismatches += mismatches;
+            free(counts);
+        }
+        if (histogram_mode)
+            destroy_partition_histogram(&hist);
+        // with -u the ranges raced with the updates, checked after them below
+        if (verify && !num_shifts) {
+            size_t mismatches = verify_ranges(num_keys, keys, num_probes, probes, ranges,
+                                              verify_sample, &num_checked);
+            printf("verified %zu probes: %zu mismatches\n", num_checked, mismatches);
+            num_mismatches += mismatches;
+        }
         free(probes);
+        if (output == OUTPUT_MMAP)
+            unmap_ranges_file(ranges, num_probes);
+        else
+            free(ranges);
+        free(row_ids);
     }
 
     double total_time = 0.0;
@@ -87,24 +1005,56 @@ int main(int argc, char *argv[]) {
     }
     printf("average elapsed time: %.3f milliseconds\n", total_time / NUM_EXPERIMENTS);
 
-    destroy_partition_tree(&tree);
-    free(gen);
-    free(keys);
-
-    return 0;
-}
-
-// NOTE: branch left if probe key is the same as delimiter
-void verify_probe(int32_t num_keys, int32_t *keys, int32_t probe, int32_t range) {
-    int32_t i = 0;
-    for (i = 0; i < num_keys; i++) {
-        if (probe <= keys[i]) {
-            if (range != i)
-                printf("WARNING: incorrect probe result, range should be %d\n",i);
-            return ;
+    if (num_shifts) {
+        pthread_join(update_thread, NULL);
+        updatable_tree_flush(&updatable);
+        printf("updates: %zu in %.3f milliseconds (%.0f/s), %zu retried on a full delta, "
+               "%zu merges\n", updatable.num_updates, updater.elapsed,
+               updater.elapsed > 0 ? updatable.num_updates / updater.elapsed * 1000 : 0.0,
+               updater.num_retries, updatable.num_merges);
+        if (verify) {
+            // the probes above raced with the updates, so the check is on
+            // fresh probes against the final snapshot and the updater's keys
+            int32_t       *probes   = source_probes(&gen, num_probes);
+            int32_t       *ranges   = malloc(sizeof(int32_t) * num_probes);
+            tree_snapshot *snapshot = acquire_snapshot(&updatable);
+            snapshot_search(snapshot, num_probes, probes, ranges);
+            size_t mismatches = snapshot_num_keys(snapshot) != updater.num_keys;
+            if (mismatches)
+                printf("mismatch: final snapshot has %d delimiters, expected %d\n",
+                       snapshot_num_keys(snapshot), updater.num_keys);
+            release_snapshot(snapshot);
+            mismatches += verify_ranges(updater.num_keys, updater.keys, num_probes, probes,
+                                        ranges, verify_sample, &num_checked);
+            printf("verified %zu probes after the updates: %zu mismatches\n", num_checked,
+                   mismatches);
+            num_mismatches += mismatches;
+            free(probes);
+            free(ranges);
         }
+        free(updater.keys);
     }
 
-    if (range != num_keys)
-        printf("WARNING: incorrect probe result, range should be %d\n", num_keys);
+    if (sink.fd > STDOUT_FILENO)
+        close(sink.fd);
+
+    if (numa_mode)
+        destroy_numa_trees(&numa);
+    if (block_bytes)
+        destroy_blocked_tree(&blocked);
+    if (min_width)
+        destroy_compressed_tree(&compressed);
+    if (radix_bits >= 0)
+        destroy_radix_table(&radix);
+    if (num_segments >= 0)
+        destroy_learned_index(&learned);
+    if (num_shifts)
+        destroy_updatable_tree(&updatable);
+    else
+        destroy_partition_tree(&tree);
+    free(gen.mt);
+    free(gen.fast);
+    free(keys);
+
+    return num_mismatches > 0;
 }
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "compressed_tree.h"
+#include "tree.h"
+#include "util.h"
+
+// a width-bit code is the delimiter's offset from the node's base, shifted
+// to start at the smallest signed value; the largest code is reserved for
+// padding (INT32_MAX), which no probe code exceeds, so a node fits a width
+// if its delimiters span at most 2^width - 2
+#define CODE_MIN(width) (-(1 << ((width) - 1)))
+#define CODE_MAX(width) ((1 << ((width) - 1)) - 1)
+
+// delimiter slots per node, so that a node is whole loads: 4 or 8 codes
+// with a partial load, 16 bytes at a time beyond that
+static int32_t code_slots(int32_t length, int32_t width) {
+    int32_t per_vec = 128 / width;
+    if (width < 32 && length <= 4)
+        return 4;
+    if (width == 8 && length <= 8)
+        return 8;
+    return round_up(length, per_vec);
+}
+
+// narrowest width all nodes of a level fit in
+static int32_t level_width(const int32_t *keys, size_t num_nodes, int32_t length,
+                           int32_t min_width) {
+    int64_t span = 0;
+    size_t n;
+    int32_t j;
+    for (n = 0; n < num_nodes; n++) {
+        const int32_t *node = keys + n * length;
+        for (j = length - 1; j > 0 && node[j] == INT32_MAX; j--)
+            ;
+        if (node[j] != INT32_MAX && (int64_t) node[j] - node[0] > span)
+            span = (int64_t) node[j] - node[0];
+    }
+
+    if (min_width <= 8 && span <= (1 << 8) - 2)
+        return 8;
+    if (min_width <= 16 && span <= (1 << 16) - 2)
+        return 16;
+    return 32;
+}
+
+void init_compressed_tree(partition_tree *tree, int32_t min_width, compressed_tree *ct) {
+    int32_t height = tree->num_levels;
+    size_t  offsets[height];
+    size_t  size = 0;
+    int32_t l;
+
+    ct->num_levels = height;
+    ct->num_keys   = tree->num_keys;
+    ct->levels     = malloc_or_die(sizeof(compressed_level) * height);
+
+    for (l = 0; l < height; l++) {
+        compressed_level *lv = &ct->levels[l];
+        int32_t length   = tree->fanouts[l] - 1;
+        size_t num_nodes = tree->level_sizes[l] / length;
+
+        lv->fanout = tree->fanouts[l];
+        lv->width  = level_width(tree->nodes[l], num_nodes, length, min_width);
+        lv->codes  = lv->width == 32 ? length : code_slots(length, lv->width);
+        lv->node_bytes = lv->width == 32 ? sizeof(int32_t) * length
+                                         : sizeof(int32_t) + lv->codes * lv->width / 8;
+        offsets[l] = size;
+        size = round_up(size + lv->node_bytes * num_nodes, TREE_NODE_ALIGN);
+    }
+
+    // a trailing 16-byte load past the last node stays inside the arena
+    ct->size = size + 16;
+    if (posix_memalign(&ct->arena, TREE_NODE_ALIGN, ct->size)) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    memset(ct->arena, 0, ct->size);
+
+    for (l = 0; l < height; l++) {
+        compressed_level *lv = &ct->levels[l];
+        int32_t length   = lv->fanout - 1;
+        size_t num_nodes = tree->level_sizes[l] / length;
+        size_t n;
+        int32_t j;
+
+        lv->nodes = (char *) ct->arena + offsets[l];
+        if (lv->width == 32) {
+            memcpy(lv->nodes, tree->nodes[l], sizeof(int32_t) * length * num_nodes);
+            continue;
+        }
+
+        for (n = 0; n < num_nodes; n++) {
+            const int32_t *src  = tree->nodes[l] + n * length;
+            char          *node = lv->nodes + n * lv->node_bytes;
+            int32_t        base = src[0] == INT32_MAX ? 0 : src[0];
+            memcpy(node, &base, sizeof(int32_t));
+
+            for (j = 0; j < lv->codes; j++) {
+                int32_t code = j < length && src[j] != INT32_MAX
+                             ? (int32_t) ((int64_t) src[j] - base) + CODE_MIN(lv->width)
+                             : CODE_MAX(lv->width);
+                if (lv->width == 16)
+                    ((int16_t *) (node + sizeof(int32_t)))[j] = code;
+                else
+                    ((int8_t *) (node + sizeof(int32_t)))[j] = code;
+            }
+        }
+    }
+}
+
+// the probe's offset from the node's base as a code, clamped so that it
+// stays on the same side of every delimiter
+static inline int32_t probe_code(const char *node, int32_t probe, int32_t width) {
+    int32_t base;
+    memcpy(&base, node, sizeof(int32_t));
+    int64_t code = (int64_t) probe - base + CODE_MIN(width);
+    return code < CODE_MIN(width) ? CODE_MIN(width)
+         : code > CODE_MAX(width) ? CODE_MAX(width) : (int32_t) code;
+}
+
+// number of delimiters less than the probe in a node of each width
+static inline int32_t node_rank32(const char *node, int32_t length, int32_t probe) {
+    const int32_t *keys = (const int32_t *) node;
+    __m128i p   = _mm_set1_epi32(probe);
+    int32_t res = 0, j;
+    for (j = 0; j + 4 <= length; j += 4)
+        res += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(p, _mm_loadu_si128((const __m128i *) (keys + j))))));
+    for (; j < length; j++)
+        res += keys[j] < probe;
+    return res;
+}
+
+static inline int32_t node_rank16(const char *node, int32_t codes, int32_t probe) {
+    const char *c = node + sizeof(int32_t);
+    __m128i p = _mm_set1_epi16(probe_code(node, probe, 16));
+    // two mask bits per 16-bit lane
+    if (codes == 4)
+        return __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpgt_epi16(p, _mm_loadl_epi64((const __m128i *) c))) & 0xff) / 2;
+
+    int32_t res = 0, j;
+    for (j = 0; j < codes; j += 8)
+        res += __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpgt_epi16(p, _mm_loadu_si128((const __m128i *) (c + 2 * j)))));
+    return res / 2;
+}
+
+static inline int32_t node_rank8(const char *node, int32_t codes, int32_t probe) {
+    const char *c = node + sizeof(int32_t);
+    __m128i p = _mm_set1_epi8(probe_code(node, probe, 8));
+    if (codes == 4) {
+        int32_t word;
+        memcpy(&word, c, sizeof(int32_t));
+        return __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpgt_epi8(p, _mm_cvtsi32_si128(word))) & 0xf);
+    }
+    if (codes == 8)
+        return __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpgt_epi8(p, _mm_loadl_epi64((const __m128i *) c))) & 0xff);
+
+    int32_t res = 0, j;
+    for (j = 0; j < codes; j += 16)
+        res += __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpgt_epi8(p, _mm_loadu_si128((const __m128i *) (c + j)))));
+    return res;
+}
+
+static inline int32_t node_rank(const compressed_level *lv, int32_t range, int32_t probe) {
+    const char *node = lv->nodes + (size_t) range * lv->node_bytes;
+    switch (lv->width) {
+    case 8:  return node_rank8(node, lv->codes, probe);
+    case 16: return node_rank16(node, lv->codes, probe);
+    default: return node_rank32(node, lv->fanout - 1, probe);
+    }
+}
+
+int32_t compressed_search_partition(compressed_tree *ct, int32_t probe) {
+    int32_t range = 0, l;
+    for (l = 0; l < ct->num_levels; l++) {
+        const compressed_level *lv = &ct->levels[l];
+        range = range * lv->fanout + node_rank(lv, range, probe);
+    }
+    return range;
+}
+
+void compressed_search_partition_batch(compressed_tree *ct, size_t num_probes,
+                                       const int32_t *probes, int32_t *ranges) {
+    size_t i;
+    int32_t l;
+    for (i = 0; i + 3 < num_probes; i += 4) {
+        int32_t range1 = 0, range2 = 0, range3 = 0, range4 = 0;
+
+        // one level for all 4 probes, so their loads overlap
+        for (l = 0; l < ct->num_levels; l++) {
+            const compressed_level *lv = &ct->levels[l];
+            range1 = range1 * lv->fanout + node_rank(lv, range1, probes[i+0]);
+            range2 = range2 * lv->fanout + node_rank(lv, range2, probes[i+1]);
+            range3 = range3 * lv->fanout + node_rank(lv, range3, probes[i+2]);
+            range4 = range4 * lv->fanout + node_rank(lv, range4, probes[i+3]);
+        }
+
+        ranges[i+0] = range1;
+        ranges[i+1] = range2;
+        ranges[i+2] = range3;
+        ranges[i+3] = range4;
+    }
+
+    // remaining 0-3 probes, one at a time
+    for (; i < num_probes; i++)
+        ranges[i] = compressed_search_partition(ct, probes[i]);
+}
+
+void destroy_compressed_tree(compressed_tree *ct) {
+    free(ct->levels);
+    free(ct->arena);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// partition tree with levels compressed to 16-bit or 8-bit delimiters
+//
+// keys under one parent span a small range on the lower levels, so each
+// node there is stored as its first key (the base) followed by the
+// offsets of its delimiters from the base, searched with _mm_cmpgt_epi16
+// or _mm_cmpgt_epi8 against the probe's offset clamped to the code range.
+// A level is stored at the narrowest width that every one of its nodes
+// fits in (the upper levels usually stay 32-bit), so a cache line holds
+// 2-4x more delimiters and more of the tree stays in cache. The ranges
+// are the same as those of the source tree.
+
+typedef struct {
+    int32_t fanout;
+    int32_t width;       // bits per delimiter: 8, 16 or 32
+    int32_t codes;       // delimiter slots per node, padded to the compare width
+    size_t  node_bytes;  // bytes per node, the 32-bit base included below 32 bits
+    char   *nodes;
+} compressed_level;
+
+typedef struct {
+    int32_t           num_levels;
+    int32_t           num_keys;
+    compressed_level *levels;
+    size_t            size;   // bytes of the arena
+    void             *arena;
+} compressed_tree;
+
+/**
+ * copies tree, any fanouts, storing each level at the narrowest of 8, 16
+ * and 32 bits its nodes fit in; no narrower than min_width, which lets
+ * benchmarks force 16 or 32 bits; the source tree is not modified and can
+ * be destroyed independently
+ */
+void init_compressed_tree(partition_tree *tree, int32_t min_width, compressed_tree *ct);
+
+/**
+ * partition of one probe
+ */
+int32_t compressed_search_partition(compressed_tree *ct, int32_t probe);
+
+/**
+ * partitions of num_probes probes, 4 interleaved per level; the ranges
+ * are the ones binary_search_partition_batch returns for the source tree
+ */
+void compressed_search_partition_batch(compressed_tree *ct, size_t num_probes,
+                                       const int32_t *probes, int32_t *ranges);
+
+/**
+ * frees all resources associated with the given compressed tree
+ */
+void destroy_compressed_tree(compressed_tree *ct);
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fastrand.h"
+#include "parallel.h"
+#include "util.h"
+
+// items per slice at the least, so small inputs don't pay for threads
+#define FASTRAND_MIN_SLICE 65536
+
+#define RADIX_BITS    8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// n-th number of the stream of seed
+static inline uint32_t stream_at(uint64_t seed, uint64_t n) {
+    uint64_t z = seed + (n + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t) ((z ^ (z >> 31)) >> 32);
+}
+
+// the work is cut into one slice per thread, of at least
+// FASTRAND_MIN_SLICE numbers, and each slice is one chunk of
+// parallel_for_chunks; every number depends only on its position in the
+// stream, so the output doesn't depend on the slicing or the thread count
+static size_t slice_size(size_t n, int32_t num_threads) {
+    size_t size = (n + num_threads - 1) / (num_threads > 0 ? num_threads : 1);
+    return size < FASTRAND_MIN_SLICE ? FASTRAND_MIN_SLICE : size;
+}
+
+static size_t num_slices(size_t n, size_t size) {
+    return n ? (n + size - 1) / size : 0;
+}
+
+fastrand_t *fastrand_init(uint64_t seed, int32_t num_threads) {
+    fastrand_t *gen = malloc_or_die(sizeof(fastrand_t));
+    gen->seed        = seed;
+    gen->next        = 0;
+    gen->num_threads = num_threads > 0 ? num_threads : 1;
+    return gen;
+}
+
+typedef struct {
+    uint64_t seed;
+    uint64_t first;  // stream index of out[0]
+    uint32_t flip;   // xor'ed into every number
+    int32_t *out;
+} fill_job;
+
+static void fill_chunk(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    fill_job *job = ctx;
+    size_t i;
+    for (i = begin; i < end; i++)
+        job->out[i] = stream_at(job->seed, job->first + i) ^ job->flip;
+}
+
+static void fill(fastrand_t *gen, size_t n, uint32_t flip, int32_t *out) {
+    fill_job job = { gen->seed, gen->next, flip, out };
+    parallel_for_chunks(n, slice_size(n, gen->num_threads), gen->num_threads,
+                        fill_chunk, &job, NULL);
+}
+
+int32_t *fastrand_generate(size_t n, fastrand_t *gen) {
+    int32_t *out = malloc_or_die(sizeof(int32_t) * n);
+    fill(gen, n, 0, out);
+    gen->next += n;
+    return out;
+}
+
+typedef struct {
+    const uint32_t *in;
+    uint32_t       *out;
+    size_t          slice;
+    int32_t         shift;
+    size_t        (*counts)[RADIX_BUCKETS];  // per slice, then its offsets
+} radix_job;
+
+static void radix_histogram(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    radix_job *job    = ctx;
+    size_t    *counts = job->counts[begin / job->slice];
+    size_t i;
+    memset(counts, 0, sizeof(size_t) * RADIX_BUCKETS);
+    for (i = begin; i < end; i++)
+        counts[(job->in[i] >> job->shift) & (RADIX_BUCKETS - 1)]++;
+}
+
+static void radix_scatter(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    radix_job *job     = ctx;
+    size_t    *offsets = job->counts[begin / job->slice];
+    size_t i;
+    for (i = begin; i < end; i++) {
+        uint32_t key = job->in[i];
+        job->out[offsets[(key >> job->shift) & (RADIX_BUCKETS - 1)]++] = key;
+    }
+}
+
+// sorts unsigned keys, the result ends up back in keys
+static void radix_sort_uint32(size_t n, uint32_t *keys, uint32_t *tmp, int32_t num_threads) {
+    size_t    slice = slice_size(n, num_threads);
+    size_t    s, ns = num_slices(n, slice);
+    radix_job job   = { keys, tmp, slice, 0, malloc_or_die(sizeof(*job.counts) * ns) };
+
+    for (job.shift = 0; job.shift < 32; job.shift += RADIX_BITS) {
+        parallel_for_chunks(n, slice, num_threads, radix_histogram, &job, NULL);
+
+        // bucket by bucket, slice by slice, which keeps the sort stable
+        size_t offset = 0;
+        int32_t b;
+        for (b = 0; b < RADIX_BUCKETS; b++) {
+            for (s = 0; s < ns; s++) {
+                size_t count = job.counts[s][b];
+                job.counts[s][b] = offset;
+                offset += count;
+            }
+        }
+
+        parallel_for_chunks(n, slice, num_threads, radix_scatter, &job, NULL);
+        const uint32_t *in = job.in;
+        job.in  = job.out;
+        job.out = (uint32_t *) in;
+    }
+    // an even number of passes, job.in is keys again
+    free(job.counts);
+}
+
+void radix_sort_int32(size_t n, int32_t *keys, int32_t *tmp, int32_t num_threads) {
+    // flipping the sign bit orders signed keys as unsigned
+    size_t i;
+    for (i = 0; i < n; i++)
+        keys[i] ^= INT32_MIN;
+    radix_sort_uint32(n, (uint32_t *) keys, (uint32_t *) tmp, num_threads);
+    for (i = 0; i < n; i++)
+        keys[i] ^= INT32_MIN;
+}
+
+typedef struct {
+    const uint32_t *in;      // sorted, sign bit flipped
+    int32_t        *out;
+    size_t          slice;
+    size_t         *ranks;   // unique keys before each slice
+    size_t          num_unique;
+    size_t          num_dropped;
+} unique_job;
+
+static void count_unique(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    unique_job *job = ctx;
+    size_t i, count = 0;
+    for (i = begin; i < end; i++)
+        count += i == 0 || job->in[i] != job->in[i-1];
+    job->ranks[begin / job->slice] = count;
+}
+
+// the r-th unique key is dropped where floor(r * d / u) steps up, which
+// spreads the d surplus keys evenly and puts kept key r at r - floor(r * d / u)
+static void write_unique(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    unique_job *job = ctx;
+    uint64_t u = job->num_unique, d = job->num_dropped;
+    uint64_t r = job->ranks[begin / job->slice];
+    size_t i;
+    for (i = begin; i < end; i++) {
+        if (i > 0 && job->in[i] == job->in[i-1])
+            continue;
+        uint64_t dropped = r * d / u;
+        if ((r + 1) * d / u == dropped)
+            job->out[r - dropped] = job->in[i] ^ INT32_MIN;
+        r++;
+    }
+}
+
+int32_t *fastrand_generate_sorted_unique(size_t n, fastrand_t *gen) {
+    int32_t num_threads = gen->num_threads;
+
+    // expect about m^2 / 2^33 collisions among m draws, plus some slack
+    size_t m = n + (size_t) ((double) n * n / 4294967296.0) + n / 64 + 64;
+    if (n > (size_t) 1 << 31) {
+        fprintf(stderr, "error: at most 2^31 unique keys can be generated\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        uint32_t *keys = malloc_or_die(sizeof(uint32_t) * m);
+        uint32_t *tmp  = malloc_or_die(sizeof(uint32_t) * m);
+        fill(gen, m, INT32_MIN, (int32_t *) keys);
+        radix_sort_uint32(m, keys, tmp, num_threads);
+        free(tmp);
+
+        size_t     slice = slice_size(m, num_threads);
+        size_t     s, ns = num_slices(m, slice);
+        unique_job job   = { keys, NULL, slice, malloc_or_die(sizeof(size_t) * ns), 0, 0 };
+        parallel_for_chunks(m, slice, num_threads, count_unique, &job, NULL);
+        for (s = 0; s < ns; s++) {
+            size_t count = job.ranks[s];
+            job.ranks[s] = job.num_unique;
+            job.num_unique += count;
+        }
+
+        if (job.num_unique >= n) {
+            // the numbers drawn are used up even if some were dropped
+            job.out         = malloc_or_die(sizeof(int32_t) * n);
+            job.num_dropped = job.num_unique - n;
+            parallel_for_chunks(m, slice, num_threads, write_unique, &job, NULL);
+            gen->next += m;
+            free(job.ranks);
+            free(keys);
+            return job.out;
+        }
+
+        // unlucky, draw more from the same start so the result stays
+        // a function of the seed
+        free(job.ranks);
+        free(keys);
+        m += m / 8 + 64;
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// multithreaded key and probe generation for large experiments
+//
+// the n-th number drawn from a generator is a hash of (seed, n)
+// (splitmix64), so any range of the stream can be produced independently
+// and the output only depends on the seed, never on the thread count;
+// sorting is an LSD radix sort and deduplication a parallel compaction
+
+typedef struct {
+    uint64_t seed;
+    uint64_t next;         // index of the next number in the stream
+    int32_t  num_threads;
+} fastrand_t;
+
+/**
+ * generator drawing from the stream of seed, using num_threads threads
+ */
+fastrand_t *fastrand_init(uint64_t seed, int32_t num_threads);
+
+/**
+ * n random numbers, the counterpart of generate()
+ */
+int32_t *fastrand_generate(size_t n, fastrand_t *gen);
+
+/**
+ * n sorted unique random numbers, the counterpart of
+ * generate_sorted_unique(): draws a few more numbers than needed, sorts
+ * and deduplicates them, then drops evenly spaced surplus keys
+ */
+int32_t *fastrand_generate_sorted_unique(size_t n, fastrand_t *gen);
+
+/**
+ * stable LSD radix sort of signed keys (8-bit digits, sign bit flipped for
+ * the last digit) on num_threads threads; tmp must hold n keys
+ */
+void radix_sort_int32(size_t n, int32_t *keys, int32_t *tmp, int32_t num_threads);
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <smmintrin.h>
+
+#include "learned_index.h"
+#include "tree.h"
+#include "util.h"
+
+// root model: the slice of the key domain the probe falls into,
+// monotonic in the probe, so each segment's keys are contiguous
+static inline int32_t segment_of(const learned_index *li, int32_t probe) {
+    double s = ((double) probe - li->min_key) * li->root_scale;
+    if (s < 0)
+        return 0;
+    return s < li->num_segments ? (int32_t) s : li->num_segments - 1;
+}
+
+// segment model: position of the probe among the keys, truncated, also
+// monotonic in the probe
+static inline int64_t predict(const learned_segment *seg, int32_t probe) {
+    return seg->begin + (int64_t) (((double) probe - seg->first_key) * seg->slope);
+}
+
+// search of the tree, for segments the models don't fit
+static int32_t tree_search(learned_index *li, int32_t probe) {
+    int32_t range;
+    binary_search_partition_simd(li->tree, probe, &range);
+    return range;
+}
+
+void init_learned_index(partition_tree *tree, int32_t num_segments, int32_t error_bound,
+                        learned_index *li) {
+    int32_t n = tree->num_keys;
+    int32_t i, s;
+
+    li->tree     = tree;
+    li->num_keys = n;
+    li->keys     = malloc_or_die(sizeof(int32_t) * (n + round_up(2 * error_bound + 2, 4)));
+    partition_tree_keys(tree, li->keys);
+
+    if (num_segments <= 0)
+        num_segments = n / LEARNED_KEYS_PER_SEGMENT > 0 ? n / LEARNED_KEYS_PER_SEGMENT : 1;
+    li->num_segments = num_segments;
+    li->error_bound  = error_bound;
+    li->min_key      = n ? li->keys[0] : 0;
+    li->root_scale   = num_segments / ((n ? (double) li->keys[n - 1] : 0.0) - li->min_key + 1);
+    li->segments     = malloc_or_die(sizeof(learned_segment) * num_segments);
+    li->num_fallback = 0;
+    int32_t worst = 0;
+
+    // the keys each slice of the domain holds
+    i = 0;
+    for (s = 0; s < num_segments; s++) {
+        learned_segment *seg = &li->segments[s];
+        seg->begin = i;
+        while (i < n && segment_of(li, li->keys[i]) == s)
+            i++;
+        seg->end = i;
+
+        // line through the first and the last key, and its error over all of them
+        int32_t count = seg->end - seg->begin;
+        seg->first_key = count ? li->keys[seg->begin] : 0;
+        seg->slope     = count > 1 ? (count - 1) / ((double) li->keys[seg->end - 1] - seg->first_key)
+                                   : 0.0;
+        seg->max_error = 0;
+        int32_t j;
+        for (j = seg->begin; j < seg->end; j++) {
+            int64_t error = predict(seg, li->keys[j]) - j;
+            if (error < 0)
+                error = -error;
+            if (error > seg->max_error)
+                seg->max_error = error;
+        }
+        if (seg->max_error > error_bound)
+            li->num_fallback++;
+        else if (seg->max_error > worst)
+            worst = seg->max_error;
+    }
+
+    // one scan width for all segments, so the scan has a fixed trip count;
+    // keys past the last one are padding that no probe exceeds
+    li->max_error  = worst;
+    li->scan_width = round_up(2 * worst + 2, 4);
+    for (i = n; i < n + li->scan_width; i++)
+        li->keys[i] = INT32_MAX;
+}
+
+// start of the probe's scan window, or -1 if its segment falls back
+static inline int32_t window_start(const learned_index *li, int32_t probe) {
+    const learned_segment *seg = &li->segments[segment_of(li, probe)];
+    if (seg->max_error > li->error_bound)
+        return -1;
+
+    // the keys before the segment are less than the probe and the keys
+    // after it are not; inside it the number less than the probe is
+    // within the error of the prediction, so it lies in
+    // [lo, lo + scan_width], also for probes beyond the segment's keys,
+    // which extrapolate past its ends
+    int64_t lo = predict(seg, probe) - li->max_error;
+    lo = lo < seg->begin ? seg->begin : lo;
+    return lo > seg->end ? seg->end : lo;
+}
+
+// range of the probe from its window, the number of keys less than it;
+// the keys are sorted across segments, so counting over the whole window
+// is exact, and no branches depend on the probe
+static inline int32_t window_range(const learned_index *li, int32_t lo, int32_t probe) {
+    const int32_t *keys = li->keys + lo;
+    __m128i p    = _mm_set1_epi32(probe);
+    int32_t rank = lo, j;
+    for (j = 0; j < li->scan_width; j += 4)
+        rank += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(p, _mm_loadu_si128((const __m128i *) (keys + j))))));
+    return rank;
+}
+
+int32_t learned_search_partition(learned_index *li, int32_t probe) {
+    int32_t lo = window_start(li, probe);
+    return lo < 0 ? tree_search(li, probe) : window_range(li, lo, probe);
+}
+
+void learned_search_partition_batch(learned_index *li, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges) {
+    // the windows of a group are predicted and prefetched first, so their
+    // misses on the keys overlap before any is scanned
+    int32_t lo[LEARNED_GROUP_SIZE];
+    size_t i, g;
+    for (i = 0; i + LEARNED_GROUP_SIZE <= num_probes; i += LEARNED_GROUP_SIZE) {
+        for (g = 0; g < LEARNED_GROUP_SIZE; g++) {
+            lo[g] = window_start(li, probes[i + g]);
+            if (lo[g] >= 0) {
+                __builtin_prefetch(li->keys + lo[g]);
+                __builtin_prefetch(li->keys + lo[g] + li->scan_width - 1);
+            }
+        }
+        for (g = 0; g < LEARNED_GROUP_SIZE; g++)
+            ranges[i + g] = lo[g] < 0 ? tree_search(li, probes[i + g])
+                                      : window_range(li, lo[g], probes[i + g]);
+    }
+
+    // remaining probes, one at a time
+    for (; i < num_probes; i++)
+        ranges[i] = learned_search_partition(li, probes[i]);
+}
+
+void print_learned_index_stats(learned_index *li) {
+    // segments by maximum error: 0, 1, 2-3, 4-7, ... up to the bound, then above it
+    int32_t counts[34] = { 0 };
+    int64_t total = 0, fallback_keys = 0;
+    int32_t worst = 0, top = 0, s, b;
+    for (s = 0; s < li->num_segments; s++) {
+        const learned_segment *seg = &li->segments[s];
+        int32_t error = seg->max_error;
+        total += error;
+        if (error > worst)
+            worst = error;
+        if (error > li->error_bound) {
+            fallback_keys += seg->end - seg->begin;
+            counts[33]++;
+            continue;
+        }
+        for (b = 0; error > 0; b++)
+            error >>= 1;
+        counts[b]++;
+        if (b > top)
+            top = b;
+    }
+
+    printf("learned: %d segments, max error per segment: mean %.2f, worst %d\n",
+           li->num_segments, total / (double) li->num_segments, worst);
+    printf("max error:");
+    for (b = 0; b <= top; b++)
+        if (b < 2)
+            printf(" %d: %d", b, counts[b]);
+        else
+            printf(" %d-%d: %d", 1 << (b - 1), (1 << b) - 1, counts[b]);
+    printf(" >%d: %d\n", li->error_bound, counts[33]);
+    printf("learned: %d segments (%.1f%% of keys) fall back to the tree\n", li->num_fallback,
+           li->num_keys ? fallback_keys * 100.0 / li->num_keys : 0.0);
+}
+
+void destroy_learned_index(learned_index *li) {
+    free(li->keys);
+    free(li->segments);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// learned index over the delimiters of a partition tree
+//
+// a root model interpolates the probe between the smallest and largest key
+// to pick one of num_segments equal slices of the key domain; each slice
+// holds the keys falling into it, and a linear model through its first
+// and last key predicts a probe's position among them. The position is
+// off by at most the segment's maximum error, measured over its keys, so
+// a SIMD scan of the sorted keys around the prediction, as wide as the
+// largest such error allows, finds the exact number of keys less than the
+// probe, which is the tree's range. Segments whose error exceeds the
+// bound search the tree instead.
+
+// keys per segment when the count is picked automatically
+#define LEARNED_KEYS_PER_SEGMENT 4
+// default error bound, above which a segment falls back to the tree
+#define LEARNED_MAX_ERROR 32
+// probes whose windows the batched search prefetches together
+#define LEARNED_GROUP_SIZE 16
+
+typedef struct {
+    int32_t begin;      // first key of the segment
+    int32_t end;        // one past its last key
+    int32_t first_key;
+    int32_t max_error;  // of the linear model over the segment's keys
+    double  slope;      // positions per key value
+} learned_segment;
+
+typedef struct {
+    partition_tree  *tree;
+    int32_t          num_keys;
+    int32_t         *keys;          // sorted, padded with scan_width INT32_MAX
+    int32_t          num_segments;
+    learned_segment *segments;
+    int32_t          min_key;
+    double           root_scale;    // segments per key value
+    int32_t          error_bound;
+    int32_t          max_error;     // largest of the segments within the bound
+    int32_t          scan_width;    // keys scanned per probe, a multiple of 4
+    int32_t          num_fallback;  // segments searching the tree
+} learned_index;
+
+/**
+ * fits the models to tree's keys; num_segments 0 picks one per
+ * LEARNED_KEYS_PER_SEGMENT keys, and segments whose maximum error exceeds
+ * error_bound search the tree; tree must outlive the index
+ */
+void init_learned_index(partition_tree *tree, int32_t num_segments, int32_t error_bound,
+                        learned_index *li);
+
+/**
+ * partition of one probe, the same as the tree's
+ */
+int32_t learned_search_partition(learned_index *li, int32_t probe);
+
+/**
+ * partitions of num_probes probes, LEARNED_GROUP_SIZE at a time with
+ * their windows prefetched before any is scanned
+ */
+void learned_search_partition_batch(learned_index *li, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges);
+
+/**
+ * prints the number of segments, the distribution of their maximum
+ * errors and how many fall back to the tree
+ */
+void print_learned_index_stats(learned_index *li);
+
+/**
+ * frees the models and the key copy, not the tree
+ */
+void destroy_learned_index(learned_index *li);
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "numa.h"
+#include "tree.h"
+#include "parallel.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+
+// parses a sysfs list such as "0-3,8-11" into a malloc'd array,
+// returns the number of entries, 0 if the file is missing
+static int32_t read_list(const char *path, int32_t **out) {
+    char buf[4096];
+    FILE *f = fopen(path, "r");
+    *out = NULL;
+    if (!f)
+        return 0;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    int32_t count = 0, capacity = 0;
+    char *p = buf;
+    while (*p >= '0' && *p <= '9') {
+        long lo = strtol(p, &p, 10), hi = lo;
+        if (*p == '-')
+            hi = strtol(p + 1, &p, 10);
+        for (; lo <= hi; lo++) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                *out = realloc(*out, sizeof(int32_t) * capacity);
+            }
+            (*out)[count++] = lo;
+        }
+        if (*p == ',')
+            p++;
+    }
+    return count;
+}
+
+static void read_topology(numa_trees *numa) {
+    int32_t *nodes;
+    int32_t  num_nodes = read_list(NODE_DIR "/online", &nodes);
+    int32_t  i;
+
+    // cpus this process may run on, the node lists are intersected with it
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    numa->num_nodes = 0;
+    for (i = 0; i < num_nodes && numa->num_nodes < NUMA_MAX_NODES; i++) {
+        char path[256];
+        int32_t *cpus;
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", nodes[i]);
+        int32_t num_cpus = read_list(path, &cpus);
+
+        // memory-only nodes get no workers, skip them
+        int32_t j, k = 0;
+        for (j = 0; j < num_cpus; j++)
+            if (cpus[j] < CPU_SETSIZE && CPU_ISSET(cpus[j], &allowed))
+                cpus[k++] = cpus[j];
+        if (k == 0) {
+            free(cpus);
+            continue;
+        }
+
+        int32_t n = numa->num_nodes++;
+        numa->node_ids[n] = nodes[i];
+        numa->cpus[n]     = cpus;
+        numa->num_cpus[n] = k;
+    }
+    free(nodes);
+
+    // no sysfs node directory, treat the host as a single node
+    if (numa->num_nodes == 0) {
+        numa->num_nodes   = 1;
+        numa->node_ids[0] = -1;
+        numa->num_cpus[0] = 0;
+        numa->cpus[0]     = malloc(sizeof(int32_t) * CPU_COUNT(&allowed));
+        for (i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &allowed))
+                numa->cpus[0][numa->num_cpus[0]++] = i;
+    }
+}
+
+// copies tree into one arena bound to node, each level on a
+// TREE_NODE_ALIGN boundary as with TREE_ALLOC_ARENA
+static void replicate(partition_tree *tree, int32_t node, numa_trees *numa, int32_t n) {
+    partition_tree *replica = &numa->replicas[n];
+    int32_t num_levels = tree->num_levels;
+    size_t  page = sysconf(_SC_PAGESIZE);
+    size_t  offsets[num_levels];
+    size_t  size = 0;
+    int32_t i;
+
+    for (i = 0; i < num_levels; i++) {
+        offsets[i] = size;
+        size += sizeof(int32_t) * partition_tree_level_size(tree, i);
+        size  = (size + TREE_NODE_ALIGN - 1) / TREE_NODE_ALIGN * TREE_NODE_ALIGN;
+    }
+    size = (size + page - 1) / page * page;
+
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    // bind before the copy, so the pages are faulted in on the node
+    if (node >= 0 && node < 8 * (int32_t) sizeof(unsigned long) * 16) {
+        unsigned long mask[16] = { 0 };
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_mbind, map, size, MPOL_BIND, mask, 8 * sizeof(mask), 0) < 0)
+            numa->bound = 0;
+    } else {
+        numa->bound = 0;
+    }
+
+    replica->num_levels   = num_levels;
+    replica->num_keys     = tree->num_keys;
+    replica->fanouts      = malloc(sizeof(int32_t) * num_levels);
+    replica->nodes        = malloc(sizeof(int32_t *) * num_levels);
+    replica->level_sizes  = malloc(sizeof(size_t) * num_levels);
+    replica->alloc_flags  = TREE_ALLOC_ARENA;
+    replica->arena        = NULL;
+    replica->mapping      = map;
+    replica->mapping_size = size;
+    for (i = 0; i < num_levels; i++) {
+        replica->fanouts[i]     = tree->fanouts[i];
+        replica->level_sizes[i] = partition_tree_level_size(tree, i);
+        replica->nodes[i]       = (int32_t *) (map + offsets[i]);
+        memcpy(replica->nodes[i], tree->nodes[i], sizeof(int32_t) * replica->level_sizes[i]);
+    }
+
+    // ask the kernel where the pages ended up
+    size_t num_pages = size / page, p;
+    void  *pages[1024];
+    int    status[1024];
+    numa->pages[n]       = num_pages;
+    numa->local_pages[n] = 0;
+    for (p = 0; p < num_pages; p += 1024) {
+        size_t count = num_pages - p < 1024 ? num_pages - p : 1024, j;
+        for (j = 0; j < count; j++)
+            pages[j] = map + (p + j) * page;
+        if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) < 0) {
+            // placement unknown, count the pages as local on a single node host
+            if (node < 0)
+                numa->local_pages[n] += count;
+            continue;
+        }
+        for (j = 0; j < count; j++)
+            if (status[j] == node || (node < 0 && status[j] >= 0))
+                numa->local_pages[n]++;
+    }
+}
+
+void init_numa_trees(partition_tree *tree, numa_trees *numa) {
+    int32_t n;
+    read_topology(numa);
+    numa->bound = 1;
+    for (n = 0; n < numa->num_nodes; n++)
+        replicate(tree, numa->node_ids[n], numa, n);
+}
+
+int32_t numa_thread_node(numa_trees *numa, int32_t num_threads, int32_t thread_id) {
+    return (int64_t) thread_id * numa->num_nodes / num_threads;
+}
+
+typedef struct {
+    numa_trees     *numa;
+    const int32_t  *probes;
+    int32_t        *ranges;
+    int32_t         group_size;
+    int32_t         num_threads;
+} numa_job;
+
+static void pin_worker(void *ctx, int32_t thread_id) {
+    numa_job *job = ctx;
+    int32_t   n   = numa_thread_node(job->numa, job->num_threads, thread_id);
+    cpu_set_t set;
+    int32_t   i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < job->numa->num_cpus[n]; i++)
+        CPU_SET(job->numa->cpus[n][i], &set);
+    if (job->numa->num_cpus[n] > 0)
+        sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void search_chunk(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    numa_job       *job  = ctx;
+    partition_tree *tree = &job->numa->replicas[numa_thread_node(job->numa, job->num_threads,
+                                                                 thread_id)];
+    if (job->group_size > 0)
+        binary_search_partition_amac(tree, end - begin, job->probes + begin,
+                                     job->ranges + begin, job->group_size);
+    else
+        binary_search_partition_batch(tree, end - begin, job->probes + begin,
+                                      job->ranges + begin);
+}
+
+double numa_search_partition(numa_trees *numa, size_t num_probes,
+                             const int32_t *probes, int32_t *ranges,
+                             int32_t group_size, int32_t num_threads,
+                             thread_stats *stats) {
+    if (num_threads < 1)
+        num_threads = 1;
+    numa_job job = { numa, probes, ranges, group_size, num_threads };
+    return parallel_for_chunks_init(num_probes, PARALLEL_CHUNK_PROBES, num_threads,
+                                    pin_worker, search_chunk, &job, stats);
+}
+
+void print_numa_stats(numa_trees *numa, thread_stats *stats, int32_t num_threads) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    int32_t n, t;
+
+    if (!numa->bound)
+        printf("numa: mbind not available, replicas placed by first touch\n");
+
+    for (n = 0; n < numa->num_nodes; n++) {
+        // a node is as fast as its slowest worker
+        size_t  items = 0;
+        double  busy  = 0.0;
+        int32_t workers = 0;
+        for (t = 0; t < num_threads; t++) {
+            if (numa_thread_node(numa, num_threads, t) != n)
+                continue;
+            items += stats[t].num_items;
+            if (stats[t].elapsed > busy)
+                busy = stats[t].elapsed;
+            workers++;
+        }
+
+        printf("node %d: replica %zu bytes, %zu/%zu pages local, %d threads on %d cpus, "
+               "%zu probes, %.2f Mprobes/s\n",
+               numa->node_ids[n] < 0 ? 0 : numa->node_ids[n],
+               numa->pages[n] * page, numa->local_pages[n], numa->pages[n],
+               workers, numa->num_cpus[n], items, busy > 0 ? items / busy / 1e6 : 0.0);
+    }
+}
+
+void destroy_numa_trees(numa_trees *numa) {
+    int32_t n;
+    for (n = 0; n < numa->num_nodes; n++) {
+        destroy_partition_tree(&numa->replicas[n]);
+        free(numa->cpus[n]);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+#include "parallel.h"
+
+// NUMA replication: one copy of the tree per memory node, probed by
+// workers pinned to that node's cpus
+//
+// the topology comes from /sys/devices/system/node and memory is bound
+// with the mbind syscall, so no libnuma is needed; hosts without NUMA
+// show up as a single node
+
+#define NUMA_MAX_NODES 64
+
+typedef struct {
+    int32_t         num_nodes;
+    int32_t         node_ids[NUMA_MAX_NODES];  // sysfs node numbers
+    int32_t        *cpus[NUMA_MAX_NODES];      // cpus of each node
+    int32_t         num_cpus[NUMA_MAX_NODES];
+    partition_tree  replicas[NUMA_MAX_NODES];  // replica bound to each node
+    size_t          pages[NUMA_MAX_NODES];     // pages of each replica
+    size_t          local_pages[NUMA_MAX_NODES];  // of those, pages found on the node
+    int32_t         bound;                     // 0 if mbind was not available
+} numa_trees;
+
+/**
+ * reads the node topology and copies tree into one arena per node, each
+ * bound to its node before first touch; the source tree is not modified
+ * and can be destroyed independently
+ */
+void init_numa_trees(partition_tree *tree, numa_trees *numa);
+
+/**
+ * node the given worker runs on, workers are split into contiguous
+ * blocks of nodes
+ */
+int32_t numa_thread_node(numa_trees *numa, int32_t num_threads, int32_t thread_id);
+
+/**
+ * same as parallel_search_partition, with every worker pinned to its
+ * node and searching that node's replica
+ * returns the wall time in seconds
+ */
+double numa_search_partition(numa_trees *numa, size_t num_probes,
+                             const int32_t *probes, int32_t *ranges,
+                             int32_t group_size, int32_t num_threads,
+                             thread_stats *stats);
+
+/**
+ * prints where each replica's pages are, and per-node throughput
+ */
+void print_numa_stats(numa_trees *numa, thread_stats *stats, int32_t num_threads);
+
+void destroy_numa_trees(numa_trees *numa);
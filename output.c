@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "output.h"
+
+// size of the buffer handed to each write()
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// longest line: two 11-character int32s, a space and a newline
+#define MAX_LINE 24
+
+static const char *output_mode_names[NUM_OUTPUT_MODES] = {
+    "printf", "text", "binary", "mmap", "none"
+};
+
+// "00" "01" ... "99", so two digits are formatted per division
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int32_t parse_output_mode(const char *name) {
+    int32_t i;
+    for (i = 0; i < NUM_OUTPUT_MODES; i++)
+        if (strcmp(name, output_mode_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// formats value at out, returns the number of characters written
+static inline size_t format_int32(char *out, int32_t value) {
+    char     tmp[12];
+    char    *end = tmp + sizeof(tmp);
+    char    *p   = end;
+    // negate in unsigned arithmetic so INT32_MIN works
+    uint32_t v   = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+
+    while (v >= 100) {
+        uint32_t pair = (v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = '0' + v;
+    }
+    if (value < 0)
+        *--p = '-';
+
+    size_t len = end - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+int open_output_file(const char *path) {
+    if (!path)
+        return STDOUT_FILENO;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+void write_text_output(int fd, size_t num_probes, const int32_t *probes, const int32_t *ranges) {
+    char *buf = malloc(OUTPUT_BUFFER_SIZE);
+    size_t len = 0;
+    size_t i;
+
+    for (i = 0; i < num_probes; i++) {
+        if (len + MAX_LINE > OUTPUT_BUFFER_SIZE) {
+            write_all(fd, buf, len);
+            len = 0;
+        }
+        len += format_int32(buf + len, probes[i]);
+        buf[len++] = ' ';
+        len += format_int32(buf + len, ranges[i]);
+        buf[len++] = '\n';
+    }
+    write_all(fd, buf, len);
+
+    free(buf);
+}
+
+void write_binary_output(int fd, size_t num_probes, const int32_t *ranges) {
+    // the ranges are already contiguous, so write them in large slices
+    const char *bytes = (const char *) ranges;
+    size_t total = num_probes * sizeof(int32_t);
+    size_t done;
+    for (done = 0; done < total; done += OUTPUT_BUFFER_SIZE) {
+        size_t len = total - done < OUTPUT_BUFFER_SIZE ? total - done : OUTPUT_BUFFER_SIZE;
+        write_all(fd, bytes + done, len);
+    }
+}
+
+int32_t *map_ranges_file(const char *path, size_t num_probes) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = num_probes * sizeof(int32_t);
+    if (ftruncate(fd, size) < 0) {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+
+    // mmap can't map an empty file, hand out a page of anonymous memory instead
+    void *map = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                     size ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS,
+                     size ? fd : -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+    return map;
+}
+
+void unmap_ranges_file(int32_t *ranges, size_t num_probes) {
+    size_t size = num_probes * sizeof(int32_t);
+    munmap(ranges, size ? size : 1);
+}
+
+uint64_t checksum_ranges(uint64_t hash, size_t num_probes, const int32_t *ranges) {
+    size_t i;
+    for (i = 0; i < num_probes; i++) {
+        hash ^= (uint32_t) ranges[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// how build writes the per-probe results
+typedef enum {
+    OUTPUT_PRINTF,    // "<probe> <range>" lines through printf
+    OUTPUT_TEXT,      // same lines, hand-formatted into large buffered writes
+    OUTPUT_BINARY,    // raw int32 ranges in probe order, large buffered writes
+    OUTPUT_MMAP,      // raw int32 ranges, searched straight into a mapped file
+    OUTPUT_CHECKSUM,  // nothing written, only a checksum of the ranges
+    NUM_OUTPUT_MODES
+} output_mode;
+
+/**
+ * parses an output mode name (printf, text, binary, mmap, none),
+ * returns -1 for an unknown name
+ */
+int32_t parse_output_mode(const char *name);
+
+// initial value for checksum_ranges
+#define CHECKSUM_INIT 0xcbf29ce484222325ULL
+
+/**
+ * opens (and truncates) path for writing, or returns stdout when path is NULL
+ */
+int open_output_file(const char *path);
+
+/**
+ * writes "<probe> <range>" lines to fd using a hand-rolled integer formatter
+ */
+void write_text_output(int fd, size_t num_probes, const int32_t *probes, const int32_t *ranges);
+
+/**
+ * writes the ranges as raw native-endian int32 to fd
+ */
+void write_binary_output(int fd, size_t num_probes, const int32_t *ranges);
+
+/**
+ * creates path sized for num_probes int32 ranges and maps it, so the search
+ * can fill the file in place; release with unmap_ranges_file
+ */
+int32_t *map_ranges_file(const char *path, size_t num_probes);
+
+/**
+ * unmaps a file from map_ranges_file, flushing it to the page cache
+ */
+void unmap_ranges_file(int32_t *ranges, size_t num_probes);
+
+/**
+ * order-dependent 64-bit checksum (FNV-1a) of the ranges, for pipelines that
+ * consume results in-process; start from CHECKSUM_INIT and pass the previous
+ * result back in to checksum a stream chunk by chunk
+ */
+uint64_t checksum_ranges(uint64_t hash, size_t num_probes, const int32_t *ranges);
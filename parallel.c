@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "parallel.h"
+#include "tree.h"
+#include "util.h"
+
+// chunk queue of one thread, padded so queues don't share cache lines
+typedef struct {
+    size_t next;
+    size_t end;
+    char   pad[64 - 2 * sizeof(size_t)];
+} chunk_queue;
+
+typedef struct {
+    size_t          num_items;
+    size_t          chunk_size;
+    int32_t         num_threads;
+    thread_init_fn  init;
+    chunk_fn        fn;
+    void           *ctx;
+    chunk_queue    *queues;
+} parallel_job;
+
+typedef struct {
+    parallel_job *job;
+    int32_t       thread_id;
+    thread_stats  stats;
+} worker;
+
+// both the owner and thieves take chunks from the front of a queue,
+// so a single fetch-and-add is enough; overshooting end just means empty
+static int take_chunk(chunk_queue *queue, size_t *chunk) {
+    if (__atomic_load_n(&queue->next, __ATOMIC_RELAXED) >= queue->end)
+        return 0;
+    *chunk = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+    return *chunk < queue->end;
+}
+
+static void run_chunk(parallel_job *job, worker *w, size_t chunk) {
+    size_t begin = chunk * job->chunk_size;
+    size_t end   = begin + job->chunk_size;
+    if (end > job->num_items)
+        end = job->num_items;
+
+    job->fn(job->ctx, w->thread_id, begin, end);
+    w->stats.num_items += end - begin;
+    w->stats.num_chunks++;
+}
+
+static void *worker_main(void *arg) {
+    worker       *w   = arg;
+    parallel_job *job = w->job;
+    size_t chunk;
+    int32_t i;
+
+    if (job->init)
+        job->init(job->ctx, w->thread_id);
+    double start = now();
+
+    while (take_chunk(&job->queues[w->thread_id], &chunk))
+        run_chunk(job, w, chunk);
+
+    // own queue is empty, steal from the others in round-robin order
+    for (i = 1; i < job->num_threads; i++) {
+        chunk_queue *victim = &job->queues[(w->thread_id + i) % job->num_threads];
+        while (take_chunk(victim, &chunk)) {
+            run_chunk(job, w, chunk);
+            w->stats.num_stolen++;
+        }
+    }
+
+    w->stats.elapsed = now() - start;
+    return NULL;
+}
+
+double parallel_for_chunks(size_t num_items, size_t chunk_size, int32_t num_threads,
+                           chunk_fn fn, void *ctx, thread_stats *stats) {
+    return parallel_for_chunks_init(num_items, chunk_size, num_threads, NULL, fn, ctx, stats);
+}
+
+double parallel_for_chunks_init(size_t num_items, size_t chunk_size, int32_t num_threads,
+                                thread_init_fn init, chunk_fn fn, void *ctx,
+                                thread_stats *stats) {
+    if (num_threads < 1)
+        num_threads = 1;
+
+    size_t num_chunks = (num_items + chunk_size - 1) / chunk_size;
+    chunk_queue *queues;
+    if (posix_memalign((void **) &queues, 64, sizeof(chunk_queue) * num_threads)) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+
+    // contiguous share of the chunks for each thread
+    int32_t i;
+    for (i = 0; i < num_threads; i++) {
+        queues[i].next = num_chunks * i / num_threads;
+        queues[i].end  = num_chunks * (i + 1) / num_threads;
+    }
+
+    parallel_job job = { num_items, chunk_size, num_threads, init, fn, ctx, queues };
+    worker    workers[num_threads];
+    pthread_t threads[num_threads];
+
+    double start = now();
+    for (i = 0; i < num_threads; i++) {
+        workers[i].job       = &job;
+        workers[i].thread_id = i;
+        workers[i].stats     = (thread_stats) { 0, 0, 0, 0.0 };
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i])) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+
+    if (stats)
+        for (i = 0; i < num_threads; i++)
+            stats[i] = workers[i].stats;
+
+    free(queues);
+    return elapsed;
+}
+
+typedef struct {
+    partition_tree *tree;
+    const int32_t  *probes;
+    int32_t        *ranges;
+    int32_t         group_size;
+} search_job;
+
+static void search_chunk(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    search_job *job = ctx;
+    if (job->group_size > 0)
+        binary_search_partition_amac(job->tree, end - begin, job->probes + begin,
+                                     job->ranges + begin, job->group_size);
+    else
+        binary_search_partition_batch(job->tree, end - begin, job->probes + begin,
+                                      job->ranges + begin);
+}
+
+double parallel_search_partition(partition_tree *tree, size_t num_probes,
+                                 const int32_t *probes, int32_t *ranges,
+                                 int32_t group_size, int32_t num_threads,
+                                 thread_stats *stats) {
+    search_job job = { tree, probes, ranges, group_size };
+    return parallel_for_chunks(num_probes, PARALLEL_CHUNK_PROBES, num_threads,
+                               search_chunk, &job, stats);
+}
+
+void print_thread_stats(thread_stats *stats, int32_t num_threads, double elapsed) {
+    size_t total = 0;
+    int32_t i;
+    for (i = 0; i < num_threads; i++) {
+        printf("thread %d: %zu probes, %zu chunks (%zu stolen), %.3f milliseconds, %.2f Mprobes/s\n",
+               i, stats[i].num_items, stats[i].num_chunks, stats[i].num_stolen,
+               stats[i].elapsed * 1000,
+               stats[i].elapsed > 0 ? stats[i].num_items / stats[i].elapsed / 1e6 : 0.0);
+        total += stats[i].num_items;
+    }
+    printf("aggregate: %zu probes on %d threads, %.3f milliseconds, %.2f Mprobes/s\n",
+           total, num_threads, elapsed * 1000,
+           elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// probes per chunk: probes and ranges of a chunk together fit in L2
+#define PARALLEL_CHUNK_PROBES 8192
+
+typedef struct {
+    size_t num_items;   // items processed by this thread
+    size_t num_chunks;  // chunks processed, including stolen ones
+    size_t num_stolen;  // chunks taken from another thread's queue
+    double elapsed;     // seconds from thread start to running out of work
+} thread_stats;
+
+/**
+ * work function for parallel_for_chunks, called with [begin, end) of one chunk
+ */
+typedef void (*chunk_fn)(void *ctx, int32_t thread_id, size_t begin, size_t end);
+
+/**
+ * called once on each worker thread before it takes its first chunk
+ */
+typedef void (*thread_init_fn)(void *ctx, int32_t thread_id);
+
+/**
+ * splits [0, num_items) into chunks of chunk_size and processes them on
+ * num_threads threads; each thread starts on its own contiguous share of
+ * the chunks and steals from the others once it runs dry
+ * stats may be NULL, otherwise it receives one entry per thread
+ * returns the wall time in seconds
+ */
+double parallel_for_chunks(size_t num_items, size_t chunk_size, int32_t num_threads,
+                           chunk_fn fn, void *ctx, thread_stats *stats);
+
+/**
+ * same as parallel_for_chunks, with init run on every worker first,
+ * e.g. to pin it to a set of cpus; init may be NULL
+ */
+double parallel_for_chunks_init(size_t num_items, size_t chunk_size, int32_t num_threads,
+                                thread_init_fn init, chunk_fn fn, void *ctx,
+                                thread_stats *stats);
+
+/**
+ * searches all probes with num_threads threads sharing the read-only tree,
+ * using binary_search_partition_batch, or binary_search_partition_amac
+ * when group_size is positive
+ * returns the wall time in seconds
+ */
+double parallel_search_partition(partition_tree *tree, size_t num_probes,
+                                 const int32_t *probes, int32_t *ranges,
+                                 int32_t group_size, int32_t num_threads,
+                                 thread_stats *stats);
+
+/**
+ * prints per-thread and aggregate throughput
+ */
+void print_thread_stats(thread_stats *stats, int32_t num_threads, double elapsed);
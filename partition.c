@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "parallel.h"
+#include "partition.h"
+#include "tree.h"
+
+// probes searched per histogram step, small enough to stay in L1
+#define HISTOGRAM_CHUNK 1024
+
+// allocates memory aligned at 64-byte (cache line) boundary
+#define LINE_ALIGNED_ALLOC(ptr, size) {                     \
+        if (posix_memalign((void **) (&(ptr)), 64, size)) { \
+            perror("posix_memalign");                       \
+            exit(EXIT_FAILURE);                             \
+        }                                                   \
+    }
+
+typedef struct {
+    int32_t slots[SWWC_LINE];
+} __attribute__((aligned(64))) swwc_line;
+
+static inline void stream_line(int32_t *dst, const swwc_line *line) {
+    const __m128i *src = (const __m128i *) line->slots;
+    __m128i *out = (__m128i *) dst;
+    _mm_stream_si128(out + 0, _mm_load_si128(src + 0));
+    _mm_stream_si128(out + 1, _mm_load_si128(src + 1));
+    _mm_stream_si128(out + 2, _mm_load_si128(src + 2));
+    _mm_stream_si128(out + 3, _mm_load_si128(src + 3));
+}
+
+// writes a full buffer to its line in the output; the first line of a
+// partition may be shared with the previous partition, and only the part
+// belonging to this one is written, with regular stores
+static inline void flush_line(int32_t *out, size_t line_start, size_t partition_start,
+                              const swwc_line *line) {
+    if (line_start >= partition_start) {
+        stream_line(out + line_start, line);
+    } else {
+        size_t s;
+        for (s = partition_start - line_start; s < SWWC_LINE; s++)
+            out[line_start + s] = line->slots[s];
+    }
+}
+
+// writes what is left in a buffer after the scatter pass
+static inline void flush_partial(int32_t *out, size_t partition_start, size_t pos,
+                                 const swwc_line *line) {
+    size_t begin = pos & ~(size_t) (SWWC_LINE - 1);
+    if (begin < partition_start)
+        begin = partition_start;
+    for (; begin < pos; begin++)
+        out[begin] = line->slots[begin & (SWWC_LINE - 1)];
+}
+
+static void scatter_swwc(partition_output *out, const int32_t *ranges,
+                         const int32_t *probes, const int32_t *payloads) {
+    int32_t num_partitions = out->num_partitions;
+    size_t *pos = malloc(sizeof(size_t) * num_partitions);
+    memcpy(pos, out->offsets, sizeof(size_t) * num_partitions);
+
+    swwc_line *key_lines, *payload_lines = NULL;
+    LINE_ALIGNED_ALLOC(key_lines, sizeof(swwc_line) * num_partitions);
+    if (payloads)
+        LINE_ALIGNED_ALLOC(payload_lines, sizeof(swwc_line) * num_partitions);
+
+    size_t i;
+    for (i = 0; i < out->num_probes; i++) {
+        int32_t r  = ranges[i];
+        size_t  at = pos[r]++;
+        size_t  slot = at & (SWWC_LINE - 1);
+
+        key_lines[r].slots[slot] = probes[i];
+        if (payloads)
+            payload_lines[r].slots[slot] = payloads[i];
+
+        if (slot == SWWC_LINE - 1) {
+            flush_line(out->keys, at - slot, out->offsets[r], &key_lines[r]);
+            if (payloads)
+                flush_line(out->payloads, at - slot, out->offsets[r], &payload_lines[r]);
+        }
+    }
+
+    int32_t p;
+    for (p = 0; p < num_partitions; p++) {
+        flush_partial(out->keys, out->offsets[p], pos[p], &key_lines[p]);
+        if (payloads)
+            flush_partial(out->payloads, out->offsets[p], pos[p], &payload_lines[p]);
+    }
+
+    // make the non-temporal stores visible before returning
+    _mm_sfence();
+
+    free(key_lines);
+    free(payload_lines);
+    free(pos);
+}
+
+static void scatter_direct(partition_output *out, const int32_t *ranges,
+                           const int32_t *probes, const int32_t *payloads) {
+    size_t *pos = malloc(sizeof(size_t) * out->num_partitions);
+    memcpy(pos, out->offsets, sizeof(size_t) * out->num_partitions);
+
+    size_t i;
+    for (i = 0; i < out->num_probes; i++) {
+        size_t at = pos[ranges[i]]++;
+        out->keys[at] = probes[i];
+        if (payloads)
+            out->payloads[at] = payloads[i];
+    }
+
+    free(pos);
+}
+
+void partition_probes(partition_tree *tree, size_t num_probes,
+                      const int32_t *probes, const int32_t *payloads,
+                      partition_output *out) {
+    int32_t num_partitions = tree->num_keys + 1;
+    out->num_partitions = num_partitions;
+    out->num_probes     = num_probes;
+    out->offsets        = calloc(num_partitions + 1, sizeof(size_t));
+    out->payloads       = NULL;
+
+    int32_t *ranges;
+    LINE_ALIGNED_ALLOC(ranges, sizeof(int32_t) * num_probes + 1);
+
+    // histogram pass: count partition sizes while the chunk's ranges are hot
+    // (offsets is shifted by one so the prefix sum below ends up in place)
+    size_t i, j;
+    for (i = 0; i < num_probes; i += HISTOGRAM_CHUNK) {
+        size_t n = num_probes - i < HISTOGRAM_CHUNK ? num_probes - i : HISTOGRAM_CHUNK;
+        binary_search_partition_batch(tree, n, probes + i, ranges + i);
+        for (j = i; j < i + n; j++)
+            out->offsets[ranges[j] + 1]++;
+    }
+
+    int32_t p;
+    for (p = 0; p < num_partitions; p++)
+        out->offsets[p + 1] += out->offsets[p];
+
+    LINE_ALIGNED_ALLOC(out->keys, sizeof(int32_t) * num_probes + 1);
+    if (payloads)
+        LINE_ALIGNED_ALLOC(out->payloads, sizeof(int32_t) * num_probes + 1);
+
+    if (num_partitions <= SWWC_MAX_PARTITIONS)
+        scatter_swwc(out, ranges, probes, payloads);
+    else
+        scatter_direct(out, ranges, probes, payloads);
+
+    free(ranges);
+}
+
+// private counters of one thread, allocated and zeroed by the thread on
+// its first chunk so that the pages are local to it
+typedef struct {
+    uint32_t *counts;
+    size_t    pending;  // probes counted since the last flush, bounds every counter
+} __attribute__((aligned(64))) histogram_counters;
+
+typedef struct {
+    partition_tree     *tree;
+    const int32_t      *probes;
+    int32_t             group_size;
+    int32_t             num_partitions;
+    int32_t             num_threads;
+    histogram_counters *own;     // one per thread, or NULL when the threads share counts
+    size_t             *counts;  // the sum
+} histogram_job;
+
+// adds a thread's counters to the shared counts before any can wrap
+static void flush_counters(histogram_job *job, histogram_counters *own) {
+    int32_t p;
+    for (p = 0; p < job->num_partitions; p++)
+        __atomic_fetch_add(&job->counts[p], own->counts[p], __ATOMIC_RELAXED);
+    memset(own->counts, 0, sizeof(uint32_t) * job->num_partitions);
+    own->pending = 0;
+}
+
+static void histogram_chunk(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    histogram_job      *job = ctx;
+    histogram_counters *own = job->own ? &job->own[thread_id] : NULL;
+    int32_t             ranges[HISTOGRAM_CHUNK];
+    size_t i, j;
+
+    if (own && !own->counts) {
+        LINE_ALIGNED_ALLOC(own->counts, sizeof(uint32_t) * job->num_partitions);
+        memset(own->counts, 0, sizeof(uint32_t) * job->num_partitions);
+    }
+
+    // the ranges of a step are counted while they are still in L1 and
+    // never written anywhere else
+    for (i = begin; i < end; i += HISTOGRAM_CHUNK) {
+        size_t n = end - i < HISTOGRAM_CHUNK ? end - i : HISTOGRAM_CHUNK;
+        if (job->group_size > 0)
+            binary_search_partition_amac(job->tree, n, job->probes + i, ranges, job->group_size);
+        else
+            binary_search_partition_batch(job->tree, n, job->probes + i, ranges);
+
+        if (own) {
+            if (own->pending + n > UINT32_MAX)
+                flush_counters(job, own);
+            for (j = 0; j < n; j++)
+                own->counts[ranges[j]]++;
+            own->pending += n;
+        } else if (job->num_threads > 1) {
+            for (j = 0; j < n; j++)
+                __atomic_fetch_add(&job->counts[ranges[j]], 1, __ATOMIC_RELAXED);
+        } else {
+            for (j = 0; j < n; j++)
+                job->counts[ranges[j]]++;
+        }
+    }
+}
+
+// adds a slice of the partitions over all threads' counters to the counts
+static void merge_chunk(void *ctx, int32_t thread_id, size_t begin, size_t end) {
+    histogram_job *job = ctx;
+    size_t p;
+    int32_t t;
+    for (p = begin; p < end; p++) {
+        size_t sum = job->counts[p];
+        for (t = 0; t < job->num_threads; t++)
+            if (job->own[t].counts)
+                sum += job->own[t].counts[p];
+        job->counts[p] = sum;
+    }
+}
+
+// smallest, largest and mean size and the heaviest partitions
+static void histogram_skew(partition_histogram *hist) {
+    int32_t n = hist->num_partitions, p, k;
+    hist->min = hist->max = hist->counts[0];
+    hist->num_empty    = 0;
+    hist->num_heaviest = 0;
+    for (p = 0; p < n; p++) {
+        size_t c = hist->counts[p];
+        hist->min = c < hist->min ? c : hist->min;
+        hist->max = c > hist->max ? c : hist->max;
+        hist->num_empty += c == 0;
+
+        // insertion into the short sorted list of the largest so far;
+        // ties keep the lower partition first
+        if (hist->num_heaviest == HISTOGRAM_HEAVIEST &&
+            c <= hist->counts[hist->heaviest[HISTOGRAM_HEAVIEST - 1]])
+            continue;
+        k = hist->num_heaviest < HISTOGRAM_HEAVIEST ? hist->num_heaviest++
+                                                    : HISTOGRAM_HEAVIEST - 1;
+        for (; k > 0 && hist->counts[hist->heaviest[k - 1]] < c; k--)
+            hist->heaviest[k] = hist->heaviest[k - 1];
+        hist->heaviest[k] = p;
+    }
+    hist->mean = hist->num_probes / (double) n;
+}
+
+double histogram_probes(partition_tree *tree, size_t num_probes, const int32_t *probes,
+                        int32_t group_size, int32_t num_threads, thread_stats *stats,
+                        partition_histogram *out) {
+    int32_t num_partitions = tree->num_keys + 1;
+    if (num_threads < 1)
+        num_threads = 1;
+    out->num_partitions = num_partitions;
+    out->num_probes     = num_probes;
+    LINE_ALIGNED_ALLOC(out->counts, sizeof(size_t) * num_partitions);
+    memset(out->counts, 0, sizeof(size_t) * num_partitions);
+
+    // one line-aligned set of counters per thread, so no two threads
+    // increment the same cache line, as long as they stay in cache; the
+    // counters of a large tree would cost threads x partitions of memory
+    // and merge traffic, and evict the tree
+    histogram_counters own[num_threads];
+    int32_t t, private = num_threads > 1 &&
+                         sizeof(uint32_t) * num_partitions <= HISTOGRAM_PRIVATE_BYTES;
+    memset(own, 0, sizeof(own));
+
+    histogram_job job = { tree, probes, group_size, num_partitions, num_threads,
+                          private ? own : NULL, out->counts };
+    double elapsed = parallel_for_chunks(num_probes, PARALLEL_CHUNK_PROBES, num_threads,
+                                         histogram_chunk, &job, stats);
+    if (private)
+        elapsed += parallel_for_chunks(num_partitions, PARALLEL_CHUNK_PROBES, num_threads,
+                                       merge_chunk, &job, NULL);
+
+    for (t = 0; t < num_threads; t++)
+        free(own[t].counts);
+    histogram_skew(out);
+    return elapsed;
+}
+
+void print_partition_histogram(const partition_histogram *hist) {
+    printf("histogram: %zu probes in %d partitions, %d empty\n", hist->num_probes,
+           hist->num_partitions, hist->num_empty);
+    printf("partition size: min %zu, max %zu, mean %.2f, max/mean %.2f\n",
+           hist->min, hist->max, hist->mean,
+           hist->mean > 0 ? hist->max / hist->mean : 0.0);
+    printf("heaviest:");
+    int32_t k;
+    for (k = 0; k < hist->num_heaviest; k++)
+        printf(" %d (%zu, %.2f%%)", hist->heaviest[k], hist->counts[hist->heaviest[k]],
+               hist->num_probes ? hist->counts[hist->heaviest[k]] * 100.0 / hist->num_probes
+                                : 0.0);
+    printf("\n");
+}
+
+void destroy_partition_histogram(partition_histogram *hist) {
+    free(hist->counts);
+}
+
+void destroy_partition_output(partition_output *out) {
+    free(out->offsets);
+    free(out->keys);
+    free(out->payloads);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parallel.h"
+#include "tree.h"
+
+// int32 slots in one software write-combining buffer (one cache line)
+#define SWWC_LINE 16
+
+// with more partitions than this the write-combining buffers no longer fit
+// in L2, and the scatter pass writes straight to the output instead
+#define SWWC_MAX_PARTITIONS 8192
+
+// partitions the skew statistics list by size
+#define HISTOGRAM_HEAVIEST 8
+
+// the histogram gives each thread private 32-bit counters while they fit
+// in this many bytes (an L2); larger trees share one set of counters
+#define HISTOGRAM_PRIVATE_BYTES (256 << 10)
+
+typedef struct {
+    int32_t  num_partitions;  // num keys of the tree + 1
+    size_t   num_probes;
+    size_t  *counts;          // probes per partition
+    size_t   min, max;        // smallest and largest partition
+    double   mean;
+    int32_t  num_empty;       // partitions no probe falls into
+    int32_t  num_heaviest;    // at most HISTOGRAM_HEAVIEST
+    int32_t  heaviest[HISTOGRAM_HEAVIEST];  // largest partitions, largest first
+} partition_histogram;
+
+typedef struct {
+    int32_t  num_partitions;  // num keys of the tree + 1
+    size_t   num_probes;
+    size_t  *offsets;         // partition p is [offsets[p], offsets[p+1])
+    int32_t *keys;            // probes grouped by partition, 64-byte aligned
+    int32_t *payloads;        // payload column in the same order, or NULL
+} partition_output;
+
+/**
+ * range-partitions the probes with the tree: a histogram pass searches every
+ * probe and counts partition sizes, the counts are prefix-summed, and a
+ * scatter pass moves each probe (and its payload, if payloads is not NULL)
+ * into its partition through write-combining buffers flushed with
+ * non-temporal stores
+ * within a partition, probes keep their input order
+ */
+void partition_probes(partition_tree *tree, size_t num_probes,
+                      const int32_t *probes, const int32_t *payloads,
+                      partition_output *out);
+
+/**
+ * counts the probes per partition without writing out their ranges: each
+ * thread searches L1-sized steps of its chunks and adds them to its own
+ * counters, which are summed once all probes are searched; with more
+ * partitions than HISTOGRAM_PRIVATE_BYTES of counters hold, the threads
+ * add to the shared counts atomically instead; group_size > 0 searches
+ * with AMAC; also computes the skew statistics of out
+ * stats may be NULL, otherwise it receives one entry per thread
+ * returns the wall time in seconds
+ */
+double histogram_probes(partition_tree *tree, size_t num_probes, const int32_t *probes,
+                        int32_t group_size, int32_t num_threads, thread_stats *stats,
+                        partition_histogram *out);
+
+/**
+ * prints the skew statistics of a histogram
+ */
+void print_partition_histogram(const partition_histogram *hist);
+
+/**
+ * frees the counts of the given histogram
+ */
+void destroy_partition_histogram(partition_histogram *hist);
+
+/**
+ * frees all resources associated with the given partition output
+ */
+void destroy_partition_output(partition_output *out);
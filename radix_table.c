@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "radix_table.h"
+#include "tree.h"
+#include "tree_kernels.h"
+#include "util.h"
+
+// node index after each level on the probe's path
+static void probe_path(partition_tree *tree, int32_t probe, int32_t *path) {
+    int32_t range = 0, l;
+    for (l = 0; l < tree->num_levels; l++) {
+        int32_t length = tree->fanouts[l] - 1;
+        range = range * tree->fanouts[l] +
+                node_rank(tree->nodes[l] + (size_t) range * length, length, probe);
+        path[l] = range;
+    }
+}
+
+// bits for RADIX_BUCKETS_PER_KEY buckets per key, so that most buckets
+// fall inside a single range
+static int32_t auto_bits(partition_tree *tree) {
+    size_t  buckets = (size_t) tree->num_keys * RADIX_BUCKETS_PER_KEY;
+    int32_t bits = RADIX_MIN_BITS;
+    while (bits < RADIX_MAX_BITS && ((size_t) 1 << bits) < buckets)
+        bits++;
+    return bits;
+}
+
+void init_radix_table(partition_tree *tree, int32_t bits, radix_table *table) {
+    int32_t height = tree->num_levels;
+    int32_t *keys  = malloc_or_die(sizeof(int32_t) * tree->num_keys);
+    size_t   n     = partition_tree_keys(tree, keys);
+    int64_t  min   = n ? keys[0] : 0;
+    int64_t  max   = n ? keys[n - 1] : 0;
+    free(keys);
+
+    if (bits <= 0)
+        bits = auto_bits(tree);
+    if (bits < RADIX_MIN_BITS)
+        bits = RADIX_MIN_BITS;
+    if (bits > RADIX_MAX_BITS)
+        bits = RADIX_MAX_BITS;
+
+    // buckets cover [min, max], the first and last one extend to the ends
+    // of the domain
+    size_t  num_buckets = (size_t) 1 << bits;
+    int32_t shift = 0;
+    while ((uint64_t) (max - min) >> shift >= num_buckets)
+        shift++;
+
+    table->bits    = bits;
+    table->shift   = shift;
+    table->min_key = min;
+    table->buckets = malloc_or_die(sizeof(radix_bucket) * num_buckets);
+
+    int32_t lo_path[height], hi_path[height];
+    size_t b;
+    for (b = 0; b < num_buckets; b++) {
+        int64_t lo = b == 0 ? INT32_MIN : min + ((int64_t) b << shift);
+        int64_t hi = b == num_buckets - 1 ? INT32_MAX : min + ((int64_t) (b + 1) << shift) - 1;
+        if (lo > INT32_MAX)
+            lo = INT32_MAX;
+        if (hi > INT32_MAX)
+            hi = INT32_MAX;
+
+        // the ranges are monotonic in the probe, so where the bucket's
+        // first and last probe agree, every probe between them does too
+        probe_path(tree, lo, lo_path);
+        probe_path(tree, hi, hi_path);
+        int32_t level = 0;
+        while (level < height && lo_path[level] == hi_path[level])
+            level++;
+
+        table->buckets[b].level = level;
+        table->buckets[b].range = level > 0 ? lo_path[level - 1] : 0;
+    }
+}
+
+static inline const radix_bucket *find_bucket(radix_table *table, int32_t probe) {
+    int64_t offset = (int64_t) probe - table->min_key;
+    size_t  last   = ((size_t) 1 << table->bits) - 1;
+    size_t  b      = offset < 0 ? 0 : (size_t) (offset >> table->shift);
+    return &table->buckets[b < last ? b : last];
+}
+
+int32_t radix_search_partition(partition_tree *tree, radix_table *table, int32_t probe) {
+    const radix_bucket *bucket = find_bucket(table, probe);
+    int32_t range = bucket->range, l;
+    for (l = bucket->level; l < tree->num_levels; l++) {
+        int32_t length = tree->fanouts[l] - 1;
+        range = range * tree->fanouts[l] +
+                node_rank(tree->nodes[l] + (size_t) range * length, length, probe);
+    }
+    return range;
+}
+
+// one probe's step down one level, unless its bucket skipped the level
+#define LEVEL_STEP(length, probe, level, range)                                 \
+    if (l >= (level))                                                           \
+        range = range * fanout + node_rank(nodes + (size_t) range * (length), length, probe)
+
+#define LEVEL_STEP4(length)                                                     \
+    do {                                                                        \
+        LEVEL_STEP(length, probes[i+0], b1->level, range1);                     \
+        LEVEL_STEP(length, probes[i+1], b2->level, range2);                     \
+        LEVEL_STEP(length, probes[i+2], b3->level, range3);                     \
+        LEVEL_STEP(length, probes[i+3], b4->level, range4);                     \
+    } while (0)
+
+void radix_search_partition_batch(partition_tree *tree, radix_table *table, size_t num_probes,
+                                  const int32_t *probes, int32_t *ranges) {
+    size_t i;
+    int32_t l;
+    for (i = 0; i + 3 < num_probes; i += 4) {
+        const radix_bucket *b1 = find_bucket(table, probes[i+0]);
+        const radix_bucket *b2 = find_bucket(table, probes[i+1]);
+        const radix_bucket *b3 = find_bucket(table, probes[i+2]);
+        const radix_bucket *b4 = find_bucket(table, probes[i+3]);
+        int32_t range1 = b1->range, range2 = b2->range, range3 = b3->range, range4 = b4->range;
+
+        // start at the shallowest level any of the 4 probes resumes at
+        int32_t first = b1->level;
+        if (b2->level < first) first = b2->level;
+        if (b3->level < first) first = b3->level;
+        if (b4->level < first) first = b4->level;
+
+        for (l = first; l < tree->num_levels; l++) {
+            const int32_t *nodes  = tree->nodes[l];
+            int32_t        fanout = tree->fanouts[l];
+            SWITCH_NODE_LENGTH(fanout, LEVEL_STEP4);
+        }
+
+        ranges[i+0] = range1;
+        ranges[i+1] = range2;
+        ranges[i+2] = range3;
+        ranges[i+3] = range4;
+    }
+
+    // remaining 0-3 probes, one at a time
+    for (; i < num_probes; i++)
+        ranges[i] = radix_search_partition(tree, table, probes[i]);
+}
+
+#undef LEVEL_STEP
+#undef LEVEL_STEP4
+
+double radix_table_skipped_levels(partition_tree *tree, radix_table *table, double *resolved) {
+    size_t num_buckets = (size_t) 1 << table->bits;
+    size_t b, skipped = 0, done = 0;
+    for (b = 0; b < num_buckets; b++) {
+        skipped += table->buckets[b].level;
+        done    += table->buckets[b].level == tree->num_levels;
+    }
+    *resolved = done / (double) num_buckets;
+    return skipped / (double) num_buckets;
+}
+
+void destroy_radix_table(radix_table *table) {
+    free(table->buckets);
+}
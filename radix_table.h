@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// radix jump table replacing the top levels of a partition tree
+//
+// the key domain between the smallest and the largest key is cut into
+// 2^bits equal buckets, indexed by the probe's offset from the smallest
+// key shifted right. For each bucket the table holds the deepest level
+// down to which all of its probes take the same path, and the node index
+// there, so a probe skips those levels and the tree search resumes below
+// them; buckets spanning several children of the root resume at the root.
+// A bucket inside one leaf range holds the final range.
+
+#define RADIX_MIN_BITS 4
+#define RADIX_MAX_BITS 16
+// buckets per key when sized automatically
+#define RADIX_BUCKETS_PER_KEY 4
+
+typedef struct {
+    int32_t range;  // node index at level, the range once level is num_levels
+    int32_t level;  // levels skipped
+} radix_bucket;
+
+typedef struct {
+    int32_t       bits;
+    int32_t       shift;    // offset from min_key >> shift is the bucket
+    int32_t       min_key;
+    radix_bucket *buckets;
+} radix_table;
+
+/**
+ * builds the table for tree with 2^bits buckets over the tree's key
+ * range; with bits 0 it is sized from the keys: RADIX_BUCKETS_PER_KEY
+ * buckets per key, between RADIX_MIN_BITS and RADIX_MAX_BITS
+ */
+void init_radix_table(partition_tree *tree, int32_t bits, radix_table *table);
+
+/**
+ * partition of one probe, any fanouts
+ */
+int32_t radix_search_partition(partition_tree *tree, radix_table *table, int32_t probe);
+
+/**
+ * partitions of num_probes probes, 4 interleaved per level below the
+ * levels their buckets skip
+ */
+void radix_search_partition_batch(partition_tree *tree, radix_table *table, size_t num_probes,
+                                  const int32_t *probes, int32_t *ranges);
+
+/**
+ * average number of levels a bucket skips, and the fraction of buckets
+ * resolved to a final range, for reporting
+ */
+double radix_table_skipped_levels(partition_tree *tree, radix_table *table, double *resolved);
+
+/**
+ * frees the table
+ */
+void destroy_radix_table(radix_table *table);
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+#include "util.h"
+
+// state shared between the reader thread and the consumer
+typedef struct {
+    int    fd;
+    size_t chunk_probes;
+    size_t max_probes;
+
+    // mmap'd input: the reader pages chunks in ahead of the consumer
+    const int32_t *map;
+    size_t         map_probes;
+
+    // read() input: rotating buffers, filled[i] probes valid in buffers[i]
+    int32_t *buffers[STREAM_BUFFERS];
+    size_t   filled[STREAM_BUFFERS];
+
+    // chunks produced by the reader and consumed so far; the reader may run
+    // at most STREAM_BUFFERS chunks ahead
+    size_t produced;
+    size_t consumed;
+    int    done;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+} stream_state;
+
+static size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+// blocks until the reader may start on chunk `produced`
+static void wait_for_space(stream_state *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->produced - s->consumed >= STREAM_BUFFERS)
+        pthread_cond_wait(&s->changed, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void publish_chunk(stream_state *s, int last) {
+    pthread_mutex_lock(&s->lock);
+    s->produced++;
+    s->done = last;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// fills one buffer with read(), returns the number of whole probes
+// (a probe cut off by the end of the input is dropped)
+static size_t read_chunk(stream_state *s, int32_t *buf, size_t want) {
+    char  *bytes = (char *) buf;
+    size_t size  = want * sizeof(int32_t);
+    size_t have  = 0;
+
+    while (have < size) {
+        ssize_t n = read(s->fd, bytes + have, size - have);
+        if (n < 0) {
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0)
+            break;
+        have += n;
+    }
+
+    return have / sizeof(int32_t);
+}
+
+static void *reader_main(void *arg) {
+    stream_state *s = arg;
+    size_t total = 0;
+
+    for (;;) {
+        wait_for_space(s);
+
+        size_t want = s->chunk_probes;
+        if (s->max_probes)
+            want = min_size(want, s->max_probes - total);
+
+        size_t got;
+        if (s->map) {
+            // the consumer reads straight from the mapping, just page it in
+            got = min_size(want, s->map_probes - total);
+            if (got)
+                madvise((void *) ((uintptr_t) (s->map + total) & ~(uintptr_t) 4095),
+                        got * sizeof(int32_t) + 4096, MADV_WILLNEED);
+        } else {
+            int32_t *buf = s->buffers[s->produced % STREAM_BUFFERS];
+            got = want ? read_chunk(s, buf, want) : 0;
+            s->filled[s->produced % STREAM_BUFFERS] = got;
+        }
+
+        total += got;
+        int last = got < s->chunk_probes || (s->max_probes && total >= s->max_probes);
+        publish_chunk(s, last);
+        if (last)
+            return NULL;
+    }
+}
+
+int stream_probes(const char *path, size_t chunk_probes, size_t max_probes,
+                  stream_fn fn, void *ctx, stream_stats *stats) {
+    double start = now();
+    stream_state s;
+    memset(&s, 0, sizeof(s));
+    s.chunk_probes = chunk_probes;
+    s.max_probes   = max_probes;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.changed, NULL);
+
+    s.fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (s.fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    size_t map_size = 0;
+    if (fstat(s.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= sizeof(int32_t)) {
+        map_size = st.st_size;
+        void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, s.fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, map_size, MADV_SEQUENTIAL);
+            s.map        = map;
+            s.map_probes = map_size / sizeof(int32_t);
+        }
+    }
+
+    size_t i;
+    if (!s.map) {
+        for (i = 0; i < STREAM_BUFFERS; i++)
+            s.buffers[i] = malloc(sizeof(int32_t) * chunk_probes);
+    }
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, reader_main, &s)) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+
+    stream_stats local = { 0, 0, 0.0, 0.0 };
+    size_t offset = 0;
+    for (;;) {
+        double wait_start = now();
+        pthread_mutex_lock(&s.lock);
+        while (s.consumed == s.produced && !s.done)
+            pthread_cond_wait(&s.changed, &s.lock);
+        int finished = s.consumed == s.produced;
+        pthread_mutex_unlock(&s.lock);
+        local.io_wait += now() - wait_start;
+
+        if (finished)
+            break;
+
+        const int32_t *probes;
+        size_t n;
+        if (s.map) {
+            n = min_size(chunk_probes, s.map_probes - offset);
+            if (max_probes)
+                n = min_size(n, max_probes - offset);
+            probes = s.map + offset;
+        } else {
+            n = s.filled[s.consumed % STREAM_BUFFERS];
+            probes = s.buffers[s.consumed % STREAM_BUFFERS];
+        }
+
+        if (n > 0) {
+            fn(ctx, n, probes);
+            local.num_probes += n;
+            local.num_chunks++;
+        }
+
+        // drop the pages behind us so the resident set stays bounded
+        if (s.map && n > 0) {
+            uintptr_t begin = (uintptr_t) (s.map + offset) & ~(uintptr_t) 4095;
+            uintptr_t end   = (uintptr_t) (s.map + offset + n) & ~(uintptr_t) 4095;
+            if (end > begin)
+                madvise((void *) begin, end - begin, MADV_DONTNEED);
+        }
+        offset += n;
+
+        pthread_mutex_lock(&s.lock);
+        s.consumed++;
+        pthread_cond_broadcast(&s.changed);
+        pthread_mutex_unlock(&s.lock);
+    }
+
+    pthread_join(reader, NULL);
+
+    if (s.map)
+        munmap((void *) s.map, map_size);
+    else
+        for (i = 0; i < STREAM_BUFFERS; i++)
+            free(s.buffers[i]);
+    if (s.fd != STDIN_FILENO)
+        close(s.fd);
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.changed);
+
+    local.elapsed = now() - start;
+    if (stats)
+        *stats = local;
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// probes per chunk handed to the consumer (4MB of input)
+#define STREAM_CHUNK_PROBES (1 << 20)
+
+// chunks in flight: one being searched, the others being read ahead
+#define STREAM_BUFFERS 3
+
+/**
+ * consumer callback, called once per chunk in input order
+ */
+typedef void (*stream_fn)(void *ctx, size_t num_probes, const int32_t *probes);
+
+typedef struct {
+    size_t num_probes;  // probes handed to the consumer
+    size_t num_chunks;
+    double io_wait;     // seconds the consumer spent waiting for input
+    double elapsed;     // seconds for the whole stream
+} stream_stats;
+
+/**
+ * streams native-endian int32 probes from path ("-" for stdin) in chunks of
+ * chunk_probes, calling fn on the calling thread for each chunk while a
+ * separate thread reads ahead, so memory stays bounded by STREAM_BUFFERS
+ * chunks whatever the input size
+ * regular files are mmap'd and paged in ahead of the consumer, anything
+ * else (pipes, stdin) is read into rotating buffers
+ * max_probes > 0 stops after that many probes
+ * stats may be NULL; returns 0 on success, -1 if the input can't be opened
+ */
+int stream_probes(const char *path, size_t chunk_probes, size_t max_probes,
+                  stream_fn fn, void *ctx, stream_stats *stats);
@@ -1,8 +1,12 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <string.h>
 #include <time.h>
+#include <sys/mman.h>
 
 #include <xmmintrin.h>
 #include <emmintrin.h>
@@ -15,7 +19,9 @@
 #include <x86intrin.h>
 
 #include "tree.h"
+#include "tree_kernels.h"
 #include "random.h"
+#include "util.h"
 
 // allocates memory aligned at 16-byte boundary
 #define ALIGNED_ALLOC(ptr, size) {                          \
@@ -53,26 +59,22 @@ int32_t min_num_keys(int32_t num_levels, int32_t *fanouts) {
     return max_num_keys(num_levels-1, fanouts+1) + 1;
 }
 
+// branchless binary search: the number of steps depends only on the
+// length, and each step advances by a masked half, so the result matches
+// node_rank for any length without mispredicting on the probe
 void binary_search_array(int32_t *array, int32_t length, int32_t probe, int32_t *lower_index, int32_t *upper_index){
-    int32_t min = *lower_index;
-    int32_t max = *upper_index + 1;
-    int32_t middle = (max + min) / 2;
-    while (max - min > 1) {
-        if (array[middle] < probe){
-            min = middle;
-        } else {
-            max = middle;
-        }
-        middle = (max + min) / 2;
-    }
-    // the probe is smaller than the smallest number in the array 
-    if (probe <= array[*lower_index]) {
-        *upper_index = *lower_index;
-        *lower_index = *upper_index - 1;
-    } else {
-        *upper_index = max;
-        *lower_index = *upper_index - 1;
+    const int32_t *base = &array[*lower_index];
+    int32_t n = length;
+    while (n > 1) {
+        int32_t half = n / 2;
+        // a mask rather than a conditional, which compilers turn into a branch
+        base += half & -(int32_t) (base[half - 1] < probe);
+        n -= half;
     }
+    // offset of the first delimiter not less than the probe
+    int32_t res = (int32_t) (base - &array[*lower_index]) + (*base < probe);
+    *upper_index = *lower_index + res;
+    *lower_index = *upper_index - 1;
 }
 
 void binary_search_partition(partition_tree *tree, int32_t probe, int32_t *range) {
@@ -156,7 +158,9 @@ void binary_search_array_simd(int32_t *array, int32_t length, int32_t probe,
     }
 
     default:
-        assert(0 && "length should be one of 4, 8, 16");
+        // any other fanout, e.g. one sized for the cache line or the page
+        res = node_rank(&array[*lower_index], length, probe);
+        break;
     }
 
     if (res == 0) {
@@ -192,12 +196,23 @@ void print128_num(__m128i var) {
            val[0], val[1], val[2], val[3]);
 }
 
+static void binary_search_partition_959_sse(partition_tree *tree, int32_t num_probes, const int32_t* probes, int32_t *ranges);
+
 // hard-coded version of binary search
-// 4 probes at a time
+// with AVX2/AVX-512 available, uses the generated 9-5-9 kernel for that instruction set
 void binary_search_partition_959(partition_tree *tree, int32_t num_probes, int32_t* probes, int32_t *ranges) {
     assert(tree->num_levels == 3);
     assert(tree->fanouts[0] == 9 && tree->fanouts[1] == 5 && tree->fanouts[2] == 9);
 
+    if (partition_tree_isa() == SIMD_SSE)
+        binary_search_partition_959_sse(tree, num_probes, probes, ranges);
+    else
+        binary_search_partition_batch(tree, num_probes, probes, ranges);
+}
+
+// 4 probes at a time, the remaining 0-3 with the per-probe search
+static void binary_search_partition_959_sse(partition_tree *tree, int32_t num_probes, const int32_t* probes, int32_t *ranges) {
+
     // load keys at root level into registers
     register __m128i root_ABCD = _mm_load_si128((__m128i *) (tree->nodes[0]));
     register __m128i root_EFGH = _mm_load_si128((__m128i *) (tree->nodes[0] + 4));
@@ -205,8 +220,10 @@ void binary_search_partition_959(partition_tree *tree, int32_t num_probes, int32
     __m128i dels_ABCD, dels_EFGH, cmp_ABCD, cmp_EFGH, cmp_A2H, cmp;
     int mask, res1, res2, res3, res4;
 
-    for (size_t i = 0; i + 3 < num_probes; i += 4) {
-        __m128i p = _mm_load_si128((__m128i *) &probes[i]);
+    size_t i;
+    for (i = 0; i + 3 < num_probes; i += 4) {
+        // probes may come from any offset into the caller's buffer
+        __m128i p = _mm_loadu_si128((const __m128i *) &probes[i]);
         register __m128i p1 = _mm_shuffle_epi32(p, _MM_SHUFFLE(0,0,0,0));
         register __m128i p2 = _mm_shuffle_epi32(p, _MM_SHUFFLE(1,1,1,1));
         register __m128i p3 = _mm_shuffle_epi32(p, _MM_SHUFFLE(2,2,2,2));
@@ -352,40 +369,431 @@ void binary_search_partition_959(partition_tree *tree, int32_t num_probes, int32
         ranges[i+2] = res3;
         ranges[i+3] = res4;
     }
+
+    for (; i < num_probes; i++)
+        binary_search_partition_simd(tree, probes[i], &ranges[i]);
 }
 
-void init_partition_tree(int32_t k, int32_t *keys, int32_t num_levels, int32_t *fanouts,
-                         partition_tree *tree) {
-    if (k > max_num_keys(num_levels, fanouts)) {
-        fprintf(stderr, "error: too many build keys for partition tree, maximum %d keys\n",
-                max_num_keys(num_levels, fanouts));
-        exit(EXIT_FAILURE);
+// SSE primitives for the batched search template (see tree_batch.inc)
+typedef __m128i probe_vec;
+
+typedef struct {
+    __m128i ABCD, EFGH, IJKL, MNOP;
+} root_regs;
+
+static ALWAYS_INLINE probe_vec probe_broadcast(int32_t probe) {
+    return _mm_set1_epi32(probe);
+}
+
+// number of keys less than the probe, given the (up to 4) registers of a node
+static ALWAYS_INLINE int32_t node_compare(__m128i p, __m128i dels_ABCD, __m128i dels_EFGH,
+                                          __m128i dels_IJKL, __m128i dels_MNOP,
+                                          const int32_t fanout) {
+    __m128i cmp_A2H, cmp_I2P, cmp;
+
+    switch (fanout) {
+    case 5:
+        cmp = _mm_packs_epi32(_mm_cmpgt_epi32(p, dels_ABCD), _mm_setzero_si128());
+        cmp = _mm_packs_epi16(cmp, _mm_setzero_si128());
+        break;
+    case 9:
+        cmp_A2H = _mm_packs_epi32(_mm_cmpgt_epi32(p, dels_ABCD),
+                                  _mm_cmpgt_epi32(p, dels_EFGH));
+        cmp     = _mm_packs_epi16(cmp_A2H, _mm_setzero_si128());
+        break;
+    default:
+        cmp_A2H = _mm_packs_epi32(_mm_cmpgt_epi32(p, dels_ABCD),
+                                  _mm_cmpgt_epi32(p, dels_EFGH));
+        cmp_I2P = _mm_packs_epi32(_mm_cmpgt_epi32(p, dels_IJKL),
+                                  _mm_cmpgt_epi32(p, dels_MNOP));
+        cmp     = _mm_packs_epi16(cmp_A2H, cmp_I2P);
+        break;
     }
 
-    if (k < min_num_keys(num_levels, fanouts)) {
-        fprintf(stderr, "error: too few build keys for partition tree, minimum %d keys\n",
-                min_num_keys(num_levels, fanouts));
-        exit(EXIT_FAILURE);
+    // or-ing in the low bit keeps bsr defined when no delimiter is smaller
+    return _bit_scan_reverse((_mm_movemask_epi8(cmp) << 1) | 1);
+}
+
+// loads only as many registers as the fanout needs
+static ALWAYS_INLINE void root_load(root_regs *root, const int32_t *node, const int32_t fanout) {
+    __m128i zero = _mm_setzero_si128();
+    root->ABCD = _mm_load_si128((__m128i *) node);
+    root->EFGH = fanout > 5 ? _mm_load_si128((__m128i *) (node + 4)) : zero;
+    root->IJKL = fanout > 9 ? _mm_load_si128((__m128i *) (node + 8)) : zero;
+    root->MNOP = fanout > 9 ? _mm_load_si128((__m128i *) (node + 12)) : zero;
+}
+
+static ALWAYS_INLINE int32_t root_search(const root_regs *root, probe_vec p, const int32_t fanout) {
+    return node_compare(p, root->ABCD, root->EFGH, root->IJKL, root->MNOP, fanout);
+}
+
+static ALWAYS_INLINE int32_t node_search(const int32_t *node, probe_vec p, const int32_t fanout) {
+    root_regs regs;
+    root_load(&regs, node, fanout);
+    return root_search(&regs, p, fanout);
+}
+
+#define BATCH_KERNEL_TABLE batch_kernels_sse
+#include "tree_batch.inc"
+#undef BATCH_KERNEL_TABLE
+
+// kernel table picked from cpuid at startup
+static simd_isa active_isa = SIMD_SSE;
+static const batch_kernel_entry *active_kernels = batch_kernels_sse;
+
+__attribute__((constructor))
+static void select_simd_isa(void) {
+    __builtin_cpu_init();
+
+    simd_isa isa = SIMD_SSE;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        isa = SIMD_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+        isa = SIMD_AVX2;
+
+    // PARTITION_TREE_ISA can force an older instruction set, e.g. for benchmarks
+    const char *forced = getenv("PARTITION_TREE_ISA");
+    if (forced) {
+        if (strcmp(forced, "sse") == 0)
+            isa = SIMD_SSE;
+        else if (strcmp(forced, "avx2") == 0 && isa >= SIMD_AVX2)
+            isa = SIMD_AVX2;
+    }
+
+    active_isa = isa;
+    switch (isa) {
+    case SIMD_AVX512: active_kernels = batch_kernels_avx512; break;
+    case SIMD_AVX2:   active_kernels = batch_kernels_avx2;   break;
+    default:          active_kernels = batch_kernels_sse;    break;
+    }
+}
+
+simd_isa partition_tree_isa(void) {
+    return active_isa;
+}
+
+const char *simd_isa_name(simd_isa isa) {
+    switch (isa) {
+    case SIMD_AVX512: return "avx512";
+    case SIMD_AVX2:   return "avx2";
+    default:          return "sse";
+    }
+}
+
+static void generic_search_batch(partition_tree *tree, size_t num_probes,
+                                 const int32_t *probes, int32_t *ranges);
+
+static batch_kernel find_batch_kernel(partition_tree *tree) {
+    size_t i, j;
+    for (i = 0; i < NUM_BATCH_KERNELS; i++) {
+        if (active_kernels[i].depth != tree->num_levels)
+            continue;
+        for (j = 0; j < tree->num_levels; j++)
+            if (active_kernels[i].fanouts[j] != tree->fanouts[j])
+                break;
+        if (j == tree->num_levels)
+            return active_kernels[i].kernel;
+    }
+    return NULL;
+}
+
+void binary_search_partition_batch(partition_tree *tree, size_t num_probes,
+                                   const int32_t *probes, int32_t *ranges) {
+    batch_kernel kernel = find_batch_kernel(tree);
+    if (kernel) {
+        kernel(tree, num_probes, probes, ranges);
+        return;
+    }
+
+    // no generated kernel for this shape, 4 probes interleaved per level
+    generic_search_batch(tree, num_probes, probes, ranges);
+}
+
+// state of one in-flight probe in the AMAC-style search
+typedef struct {
+    int32_t probe;
+    int32_t level;  // next level to search
+    int32_t range;  // node index at that level
+    size_t  index;  // position in probes/ranges, AMAC_IDLE when the slot is empty
+} amac_state;
+
+#define AMAC_IDLE SIZE_MAX
+
+static ALWAYS_INLINE void prefetch_node(const int32_t *node, int32_t fanout) {
+    _mm_prefetch((const char *) node, _MM_HINT_T0);
+    // a 17-way node is 64 bytes and may straddle two cache lines
+    _mm_prefetch((const char *) (node + fanout - 2), _MM_HINT_T0);
+}
+
+// the kernels' node search for the fanouts they are generated for, the
+// masked one for any other
+static ALWAYS_INLINE int32_t any_node_search(const int32_t *node, int32_t fanout, int32_t probe) {
+    switch (fanout) {
+    case 5:  return node_search(node, _mm_set1_epi32(probe), 5);
+    case 9:  return node_search(node, _mm_set1_epi32(probe), 9);
+    case 17: return node_search(node, _mm_set1_epi32(probe), 17);
+    default: return node_rank(node, fanout - 1, probe);
+    }
+}
+
+void binary_search_partition_amac(partition_tree *tree, size_t num_probes,
+                                  const int32_t *probes, int32_t *ranges,
+                                  int32_t group_size) {
+    int32_t height   = tree->num_levels;
+    int32_t *fanouts = tree->fanouts;
+    int32_t **nodes  = tree->nodes;
+
+    // the root is register resident, nothing to hide
+    if (height == 1) {
+        binary_search_partition_batch(tree, num_probes, probes, ranges);
+        return;
+    }
+
+    if (group_size < 1)
+        group_size = 1;
+    if (group_size > AMAC_MAX_GROUP)
+        group_size = AMAC_MAX_GROUP;
+
+    // only roots of the generated fanouts fit the registers
+    int32_t root_in_regs = fanouts[0] == 5 || fanouts[0] == 9 || fanouts[0] == 17;
+    root_regs root;
+    if (root_in_regs)
+        root_load(&root, nodes[0], fanouts[0]);
+
+    amac_state states[AMAC_MAX_GROUP];
+    size_t  next   = 0;
+    int32_t active = 0;
+    int32_t j;
+
+    for (j = 0; j < group_size; j++)
+        states[j].index = AMAC_IDLE;
+
+    do {
+        for (j = 0; j < group_size; j++) {
+            amac_state *s = &states[j];
+
+            if (s->index != AMAC_IDLE) {
+                // the node was prefetched on this slot's previous visit
+                int32_t fanout = fanouts[s->level];
+                const int32_t *node = nodes[s->level] + s->range * (fanout - 1);
+                s->range = s->range * fanout + any_node_search(node, fanout, s->probe);
+
+                if (++s->level < height) {
+                    fanout = fanouts[s->level];
+                    prefetch_node(nodes[s->level] + s->range * (fanout - 1), fanout);
+                    continue;
+                }
+
+                ranges[s->index] = s->range;
+                s->index = AMAC_IDLE;
+                active--;
+            }
+
+            // slot is free, start the next probe: search the root and
+            // prefetch its node on the second level
+            if (next < num_probes) {
+                s->probe = probes[next];
+                s->index = next++;
+                s->level = 1;
+                s->range = root_in_regs ? root_search(&root, _mm_set1_epi32(s->probe), fanouts[0])
+                                        : any_node_search(nodes[0], fanouts[0], s->probe);
+                prefetch_node(nodes[1] + s->range * (fanouts[1] - 1), fanouts[1]);
+                active++;
+            }
+        }
+    } while (active > 0);
+}
+
+// first index in [begin, end) whose probe is greater than bound, galloping
+// from begin so that short runs cost as little as long ones
+static size_t run_end(const int32_t *probes, size_t begin, size_t end, int64_t bound) {
+    size_t lo = begin, step = 1;
+    while (lo + step < end && probes[lo + step] <= bound) {
+        lo  += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < end ? lo + step : end;
+    // probes[lo] <= bound, the end lies in (lo, hi]
+    while (hi - lo > 1) {
+        size_t middle = lo + (hi - lo) / 2;
+        if (probes[middle] <= bound)
+            lo = middle;
+        else
+            hi = middle;
     }
+    return hi;
+}
 
-    tree->num_levels = num_levels;
-    ALIGNED_ALLOC(tree->fanouts, sizeof(int32_t  ) * num_levels);
-    ALIGNED_ALLOC(tree->nodes,   sizeof(int32_t *) * num_levels);
+size_t binary_search_partition_sorted(partition_tree *tree, size_t num_probes,
+                                      const int32_t *probes, partition_run *runs) {
+    int32_t height   = tree->num_levels;
+    int32_t *fanouts = tree->fanouts;
+    int32_t **nodes  = tree->nodes;
+
+    // the path of the previous probe: the node searched at each level, and
+    // the largest probe the chosen child covers (INT64_MAX for the last child)
+    int32_t node[height];
+    int64_t bound[height];
+    size_t  num_runs = 0;
+    size_t  i = 0;
+
+    while (i < num_probes) {
+        int32_t probe = probes[i];
+
+        // go up only until the probe is back inside a node's interval;
+        // the first probe starts at the root
+        int32_t level = 0;
+        if (i > 0) {
+            level = height - 1;
+            while (level > 0 && probe > bound[level - 1])
+                level--;
+        } else {
+            node[0] = 0;
+        }
+
+        // and down again from there
+        int32_t range = node[level];
+        for (; level < height; level++) {
+            int32_t length = fanouts[level] - 1;
+            const int32_t *n = nodes[level] + (size_t) range * length;
+            int32_t res = node_rank(n, length, probe);
+
+            node[level]  = range;
+            bound[level] = res < length ? n[res] : level > 0 ? bound[level - 1] : INT64_MAX;
+            range = range * fanouts[level] + res;
+        }
 
+        // every following probe up to the bound of the leaf falls in this range
+        size_t end = run_end(probes, i, num_probes, bound[height - 1]);
+        runs[num_runs].range = range;
+        runs[num_runs].end   = end;
+        num_runs++;
+        i = end;
+    }
+    return num_runs;
+}
+
+// 4 probes interleaved per level, for fanouts without a generated kernel
+static void generic_search_batch(partition_tree *tree, size_t num_probes,
+                                 const int32_t *probes, int32_t *ranges) {
+    int32_t height = tree->num_levels;
+    int32_t l;
     size_t i;
-    for (i = 0; i < num_levels; i++) {
-        // allocate memory for each level of tree (represented as a single array)
-        tree->fanouts[i] = fanouts[i];
-        ALIGNED_ALLOC(tree->nodes[i],
-                      sizeof(int32_t) * num_keys_at_level(i, fanouts));
+    for (i = 0; i + 3 < num_probes; i += 4) {
+        int32_t res1 = 0, res2 = 0, res3 = 0, res4 = 0;
+        for (l = 0; l < height; l++) {
+            int32_t fanout = tree->fanouts[l];
+            int32_t length = fanout - 1;
+            const int32_t *lvl = tree->nodes[l];
+            res1 = res1 * fanout + node_rank(lvl + (size_t) res1 * length, length, probes[i+0]);
+            res2 = res2 * fanout + node_rank(lvl + (size_t) res2 * length, length, probes[i+1]);
+            res3 = res3 * fanout + node_rank(lvl + (size_t) res3 * length, length, probes[i+2]);
+            res4 = res4 * fanout + node_rank(lvl + (size_t) res4 * length, length, probes[i+3]);
+        }
+        ranges[i+0] = res1;
+        ranges[i+1] = res2;
+        ranges[i+2] = res3;
+        ranges[i+3] = res4;
     }
 
-    // tail at each level
-    size_t tails[num_levels];
+    // remaining 0-3 probes, one at a time
+    for (; i < num_probes; i++) {
+        int32_t res = 0;
+        for (l = 0; l < height; l++) {
+            int32_t length = tree->fanouts[l] - 1;
+            res = res * tree->fanouts[l] +
+                  node_rank(tree->nodes[l] + (size_t) res * length, length, probes[i]);
+        }
+        ranges[i] = res;
+    }
+}
+
+// one level for one interval: while both bounds are still in the same
+// node they share its load, below the level where they part each bound
+// descends on its own
+static ALWAYS_INLINE void interval_step(const int32_t *lvl, int32_t fanout, int32_t lo, int32_t hi,
+                                        partition_interval *iv) {
+    int32_t length = fanout - 1, a, b;
+    if (iv->first == iv->last) {
+        node_rank2(lvl + (size_t) iv->first * length, length, lo, hi, &a, &b);
+    } else {
+        a = node_rank(lvl + (size_t) iv->first * length, length, lo);
+        b = node_rank(lvl + (size_t) iv->last * length, length, hi);
+    }
+    iv->first = iv->first * fanout + a;
+    iv->last  = iv->last * fanout + b;
+}
+
+#define INTERVAL_STEP4(length)                                                  \
+    do {                                                                        \
+        interval_step(lvl, (length) + 1, lo[i+0], hi[i+0], &out[i+0]);          \
+        interval_step(lvl, (length) + 1, lo[i+1], hi[i+1], &out[i+1]);          \
+        interval_step(lvl, (length) + 1, lo[i+2], hi[i+2], &out[i+2]);          \
+        interval_step(lvl, (length) + 1, lo[i+3], hi[i+3], &out[i+3]);          \
+    } while (0)
+
+void binary_search_partition_intervals(partition_tree *tree, size_t num_intervals,
+                                       const int32_t *lo, const int32_t *hi,
+                                       partition_interval *out) {
+    int32_t height = tree->num_levels;
+    int32_t l;
+    size_t i;
+    for (i = 0; i + 3 < num_intervals; i += 4) {
+        out[i+0].first = out[i+0].last = 0;
+        out[i+1].first = out[i+1].last = 0;
+        out[i+2].first = out[i+2].last = 0;
+        out[i+3].first = out[i+3].last = 0;
+
+        // one level for all 4 intervals, so their loads overlap
+        for (l = 0; l < height; l++) {
+            const int32_t *lvl = tree->nodes[l];
+            SWITCH_NODE_LENGTH(tree->fanouts[l], INTERVAL_STEP4);
+        }
+    }
+
+    // remaining 0-3 intervals, one at a time
+    for (; i < num_intervals; i++) {
+        out[i].first = out[i].last = 0;
+        for (l = 0; l < height; l++)
+            interval_step(tree->nodes[l], tree->fanouts[l], lo[i], hi[i], &out[i]);
+    }
+
+    // empty intervals overlap nothing
+    for (i = 0; i < num_intervals; i++)
+        if (lo[i] > hi[i])
+            out[i].last = out[i].first - 1;
+}
+
+#undef INTERVAL_STEP4
 
+void binary_search_partition_lookup(partition_tree *tree, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges) {
+    // pick the search once for all chunks
+    batch_kernel kernel = find_batch_kernel(tree);
+    int hard_coded = active_isa == SIMD_SSE && tree->num_levels == 3 &&
+                     tree->fanouts[0] == 9 && tree->fanouts[1] == 5 && tree->fanouts[2] == 9;
+
+    size_t i;
+    for (i = 0; i < num_probes; i += PARTITION_LOOKUP_CHUNK) {
+        size_t n = num_probes - i < PARTITION_LOOKUP_CHUNK ? num_probes - i
+                                                           : PARTITION_LOOKUP_CHUNK;
+        if (hard_coded)
+            binary_search_partition_959_sse(tree, n, probes + i, ranges + i);
+        else if (kernel)
+            kernel(tree, n, probes + i, ranges + i);
+        else
+            generic_search_batch(tree, n, probes + i, ranges + i);
+    }
+}
+
+// inserts the sorted keys bottom-up, leaving the number of keys placed
+// on each level in tails; with nodes NULL only the tails are computed
+static void place_keys(int32_t k, int32_t *keys, int32_t num_levels, int32_t *fanouts,
+                       int32_t **nodes, size_t *tails) {
     // boolean indicating whether each level just had a node filled
     int32_t filled[num_levels]; 
 
+    size_t i;
     for (i = 0; i < num_levels; i++) {
         tails[i] = 0;
         filled[i] = 0;
@@ -400,29 +808,199 @@ void init_partition_tree(int32_t k, int32_t *keys, int32_t num_levels, int32_t *
                 continue;
             } else {
                 // insert key at this level
-                tree->nodes[j][tails[j]] = keys[i];
+                if (nodes)
+                    nodes[j][tails[j]] = keys[i];
                 tails[j]++;
-                if (tails[j] % (tree->fanouts[j] - 1) == 0) {
+                if (tails[j] % (fanouts[j] - 1) == 0) {
                     filled[j] = 1;
                 }
                 break;
             }
         }
     }
+}
+
+// slots each level needs so that every node a search can reach exists:
+// the right-most reachable node of a level is the one the largest probe
+// descends into, and its child at the next level is the last one needed
+static void trimmed_level_sizes(int32_t num_levels, int32_t *fanouts, size_t *tails,
+                                size_t *sizes) {
+    size_t last = 0;  // right-most reachable node at this level
+    int32_t i;
+    for (i = 0; i < num_levels; i++) {
+        size_t length = fanouts[i] - 1;
+        sizes[i] = (last + 1) * length;
+
+        // keys in that node, the level is filled left to right
+        size_t in_node = tails[i] > last * length ? tails[i] - last * length : 0;
+        if (in_node > length)
+            in_node = length;
+        last = last * fanouts[i] + in_node;
+    }
+}
+
+void partition_tree_min_level_sizes(int32_t k, int32_t num_levels, int32_t *fanouts,
+                                    size_t *sizes) {
+    size_t tails[num_levels];
+    place_keys(k, NULL, num_levels, fanouts, NULL, tails);
+    trimmed_level_sizes(num_levels, fanouts, tails, sizes);
+}
+
+// from linux/mman.h, which older libcs do not pull in
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)
+#define MAP_HUGE_1GB (30 << 26)
+#endif
+
+// allocates the arena for every level; huge pages come from MAP_HUGETLB,
+// or from transparent huge pages when none are reserved
+static void *alloc_arena(size_t size, int32_t *flags, partition_tree *tree) {
+    if (!(*flags & (TREE_ALLOC_HUGE_2MB | TREE_ALLOC_HUGE_1GB))) {
+        void *arena;
+        if (posix_memalign(&arena, TREE_NODE_ALIGN, size)) {
+            perror("posix_memalign");
+            exit(EXIT_FAILURE);
+        }
+        tree->arena = arena;
+        return arena;
+    }
+
+    size_t page = *flags & TREE_ALLOC_HUGE_1GB ? (size_t) 1 << 30 : (size_t) 1 << 21;
+    int    huge = *flags & TREE_ALLOC_HUGE_1GB ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+    size_t len  = round_up(size, page);
+    char  *map  = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge, -1, 0);
+
+    if (map == MAP_FAILED) {
+        // over-allocate so the arena can start on a 2MB boundary, which
+        // transparent huge pages need
+        page = (size_t) 1 << 21;
+        len  = round_up(size, page);
+        map  = mmap(NULL, len + page, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+
+        char *aligned = (char *) round_up((uintptr_t) map, page);
+        if (aligned > map)
+            munmap(map, aligned - map);
+        munmap(aligned + len, map + page - aligned);
+        map = aligned;
+
+        madvise(map, len, MADV_HUGEPAGE);
+        *flags = (*flags & ~(TREE_ALLOC_HUGE_2MB | TREE_ALLOC_HUGE_1GB)) | TREE_ALLOC_THP;
+    }
+
+    tree->mapping      = map;
+    tree->mapping_size = len;
+    return map;
+}
+
+void init_partition_tree(int32_t k, int32_t *keys, int32_t num_levels, int32_t *fanouts,
+                         partition_tree *tree) {
+    init_partition_tree_alloc(k, keys, num_levels, fanouts, 0, tree);
+}
+
+void init_partition_tree_alloc(int32_t k, int32_t *keys, int32_t num_levels, int32_t *fanouts,
+                               int32_t flags, partition_tree *tree) {
+    if (k > max_num_keys(num_levels, fanouts)) {
+        fprintf(stderr, "error: too many build keys for partition tree, maximum %d keys\n",
+                max_num_keys(num_levels, fanouts));
+        exit(EXIT_FAILURE);
+    }
+
+    if (k < min_num_keys(num_levels, fanouts)) {
+        fprintf(stderr, "error: too few build keys for partition tree, minimum %d keys\n",
+                min_num_keys(num_levels, fanouts));
+        exit(EXIT_FAILURE);
+    }
+
+    // huge pages only make sense for the single arena
+    if (flags & (TREE_ALLOC_HUGE_2MB | TREE_ALLOC_HUGE_1GB))
+        flags |= TREE_ALLOC_ARENA;
+
+    tree->num_levels   = num_levels;
+    tree->num_keys     = k;
+    tree->mapping      = NULL;
+    tree->mapping_size = 0;
+    tree->arena        = NULL;
+    ALIGNED_ALLOC(tree->fanouts,     sizeof(int32_t  ) * num_levels);
+    ALIGNED_ALLOC(tree->nodes,       sizeof(int32_t *) * num_levels);
+    ALIGNED_ALLOC(tree->level_sizes, sizeof(size_t   ) * num_levels);
+
+    // tail at each level
+    size_t tails[num_levels];
+
+    size_t i;
+    for (i = 0; i < num_levels; i++)
+        tree->fanouts[i] = fanouts[i];
+
+    if (flags & TREE_ALLOC_ARENA) {
+        // one arena, each level trimmed to the nodes a search can reach and
+        // starting on a cache line, so no node straddles two lines
+        place_keys(k, keys, num_levels, fanouts, NULL, tails);
+        trimmed_level_sizes(num_levels, fanouts, tails, tree->level_sizes);
+
+        size_t offsets[num_levels];
+        size_t size = 0;
+        for (i = 0; i < num_levels; i++) {
+            offsets[i] = size;
+            size = round_up(size + sizeof(int32_t) * tree->level_sizes[i], TREE_NODE_ALIGN);
+        }
+
+        char *arena = alloc_arena(size, &flags, tree);
+        for (i = 0; i < num_levels; i++)
+            tree->nodes[i] = (int32_t *) (arena + offsets[i]);
+    } else {
+        for (i = 0; i < num_levels; i++) {
+            // allocate memory for each level of tree (represented as a single array)
+            tree->level_sizes[i] = num_keys_at_level(i, fanouts);
+            ALIGNED_ALLOC(tree->nodes[i], sizeof(int32_t) * tree->level_sizes[i]);
+        }
+    }
+    tree->alloc_flags = flags;
+
+    place_keys(k, keys, num_levels, fanouts, tree->nodes, tails);
 
     // pad each level to the fullest with INT32_MAX
+    size_t j;
     for (i = 0; i < num_levels; i++) {
-        int32_t nkeys = num_keys_at_level(i, fanouts);
-        for (j = tails[i]; j < nkeys; j++)
+        for (j = tails[i]; j < tree->level_sizes[i]; j++)
             tree->nodes[i][j] = INT32_MAX;
     }
 }
 
+// in-order walk of the subtree under the given node
+static void collect_keys(partition_tree *tree, int32_t level, size_t node,
+                         int32_t *keys, size_t *num_out) {
+    size_t length = tree->fanouts[level] - 1;
+    if ((node + 1) * length > tree->level_sizes[level])
+        return;
+
+    size_t j;
+    for (j = 0; j <= length && *num_out < tree->num_keys; j++) {
+        if (level + 1 < tree->num_levels)
+            collect_keys(tree, level + 1, node * tree->fanouts[level] + j, keys, num_out);
+        if (j < length && *num_out < tree->num_keys)
+            keys[(*num_out)++] = tree->nodes[level][node * length + j];
+    }
+}
+
+size_t partition_tree_keys(partition_tree *tree, int32_t *keys) {
+    // keys were placed bottom-up in sorted order, so the first num_keys
+    // slots of an in-order walk are the keys and padding follows them
+    size_t num_out = 0;
+    collect_keys(tree, 0, 0, keys, &num_out);
+    return num_out;
+}
+
 void print_partition_tree(partition_tree *tree) {
     size_t i, j;
     for (i = 0; i != tree->num_levels; i++) {
-        int32_t keys_at_level = num_keys_at_level(i, tree->fanouts);
-        printf("level %zu: %d keys\n[", i, keys_at_level);
+        size_t keys_at_level = tree->level_sizes[i];
+        printf("level %zu: %zu keys\n[", i, keys_at_level);
 
         for (j = 0; j < keys_at_level; j++) {
             if (tree->nodes[i][j] == INT32_MAX) {
@@ -436,11 +1014,24 @@ void print_partition_tree(partition_tree *tree) {
     }
 }
 
+size_t partition_tree_level_size(partition_tree *tree, int32_t level) {
+    return tree->level_sizes[level];
+}
+
 void destroy_partition_tree(partition_tree *tree) {
     free(tree->fanouts);
+    free(tree->level_sizes);
     size_t i;
-    for (i = 0; i != tree->num_levels; i++) {
-        free(tree->nodes[i]);
+    if (tree->mapping) {
+        // levels point into a file mapped by load_partition_tree,
+        // or into a huge page arena
+        munmap(tree->mapping, tree->mapping_size);
+    } else if (tree->arena) {
+        free(tree->arena);
+    } else {
+        for (i = 0; i != tree->num_levels; i++) {
+            free(tree->nodes[i]);
+        }
     }
     free(tree->nodes);
 }
@@ -1,11 +1,37 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct partition_tree {
     int32_t num_levels;
+    int32_t num_keys;
     int32_t *fanouts;
     int32_t **nodes;
+    size_t  *level_sizes;  // int32 slots of each level, padding included
+    int32_t alloc_flags;   // TREE_ALLOC_* the levels were allocated with
+    void   *arena;         // heap arena holding every level, or NULL
+    void   *mapping;       // mapped file or huge page arena holding every level, or NULL
+    size_t  mapping_size;
 } partition_tree;
 
+// allocation flags for init_partition_tree_alloc
+#define TREE_ALLOC_ARENA    1  // all levels in one arena, trimmed to the key count
+#define TREE_ALLOC_HUGE_2MB 2  // arena backed by 2MB huge pages (implies ARENA)
+#define TREE_ALLOC_HUGE_1GB 4  // arena backed by 1GB huge pages (implies ARENA)
+#define TREE_ALLOC_THP      8  // set on return when no huge pages were reserved and
+                               // the arena fell back to transparent huge pages
+
+// alignment of every level in an arena, so 17-way nodes fill whole cache lines
+#define TREE_NODE_ALIGN 64
+
+// instruction sets the batched search kernels are built for
+typedef enum {
+    SIMD_SSE,
+    SIMD_AVX2,
+    SIMD_AVX512
+} simd_isa;
+
 /**
  * initializes and builds a partition tree with the given number 
  * of keys, levels, and fanout at each level
@@ -16,26 +42,151 @@ void init_partition_tree(int32_t k, int32_t *keys,
                          partition_tree *tree);
 
 /**
- * return the partition of the given probe
+ * same as init_partition_tree, with the levels allocated as flags asks:
+ * with TREE_ALLOC_ARENA all levels share one allocation, each level
+ * starting on a TREE_NODE_ALIGN boundary and holding only the nodes a
+ * search can reach instead of the maximum for the fanouts
+ * tree->alloc_flags reports what was actually used
+ */
+void init_partition_tree_alloc(int32_t k, int32_t *keys,
+                               int32_t num_levels, int32_t fanouts[],
+                               int32_t flags, partition_tree *tree);
+
+/**
+ * return the partition of the given probe, any fanouts, with a
+ * branchless binary search per node
  */
 void binary_search_partition(partition_tree *tree, int32_t probe, int32_t *range);
 
 /**
- * return the partition of the given probe, using SIMD instructions
+ * return the partition of the given probe, using SIMD instructions,
+ * any fanouts: nodes of other lengths than 4, 8 and 16 are compared a
+ * vector at a time, the last partial vector masked
  */
 void binary_search_partition_simd(partition_tree *tree, int32_t probe, int32_t *range);
 
 /**
  * hard-coded version of binary search for 9-5-9 trees
  * incorporates additional optimizations
+ * runs the AVX2/AVX-512 9-5-9 kernel when the host supports it
+ * any number of probes, probes and ranges need no particular alignment
  */
 void binary_search_partition_959(partition_tree *tree, int32_t num_probes, int32_t* probes, int32_t *ranges);
 
+/**
+ * batched search for trees of up to 4 levels with fanouts of 5, 9 or 17
+ * interleaves 4 probes per level and keeps the root in registers,
+ * using a kernel generated for the tree's fanout tuple
+ * other shapes, any fanouts, interleave 4 probes per level without
+ * the root in registers
+ * probes and ranges need no particular alignment
+ */
+void binary_search_partition_batch(partition_tree *tree, size_t num_probes,
+                                   const int32_t *probes, int32_t *ranges);
+
+// probes per chunk of binary_search_partition_lookup, so that a chunk's
+// probes and ranges (16KB) stay in L1 while it is searched
+#define PARTITION_LOOKUP_CHUNK 2048
+
+/**
+ * batched search for any tree, any number of probes and any alignment of
+ * probes and ranges: runs the hard-coded 9-5-9 search, the generated
+ * kernel for the tree's fanouts, or 4 interleaved probes per level for
+ * other fanouts, over chunks of PARTITION_LOOKUP_CHUNK probes; the last
+ * 0-3 probes of a chunk are searched one at a time
+ */
+void binary_search_partition_lookup(partition_tree *tree, size_t num_probes,
+                                    const int32_t *probes, int32_t *ranges);
+
+// upper bound on the AMAC group size
+#define AMAC_MAX_GROUP 64
+
+/**
+ * search for trees larger than cache: keeps group_size probes in flight,
+ * each with its own state, and prefetches a probe's next node before
+ * switching to the next probe so the cache misses overlap
+ * (asynchronous memory access chaining); any fanouts, with the root
+ * in registers for fanouts 5, 9 and 17
+ */
+void binary_search_partition_amac(partition_tree *tree, size_t num_probes,
+                                  const int32_t *probes, int32_t *ranges,
+                                  int32_t group_size);
+
+// run of consecutive sorted probes falling into the same range
+typedef struct {
+    int32_t range;
+    size_t  end;    // index one past the last probe of the run
+} partition_run;
+
+/**
+ * search for probes sorted in ascending order, any fanouts: each probe
+ * climbs the previous probe's path only as far as needed, and probes up
+ * to the delimiter bounding a range are skipped with a galloping search
+ * writes one run per distinct range (at most num_probes) and returns
+ * their number
+ */
+size_t binary_search_partition_sorted(partition_tree *tree, size_t num_probes,
+                                      const int32_t *probes, partition_run *runs);
+
+// first and last range an interval of probes overlaps
+typedef struct {
+    int32_t first;  // range of the interval's lower bound
+    int32_t last;   // range of its upper bound, first - 1 if the interval is empty
+} partition_interval;
+
+/**
+ * ranges each closed interval [lo[i], hi[i]] overlaps, any fanouts: both
+ * bounds share one descent, one node load per level, down to the level
+ * where their paths part; 4 intervals are interleaved per level
+ * intervals with lo[i] > hi[i] are empty
+ */
+void binary_search_partition_intervals(partition_tree *tree, size_t num_intervals,
+                                       const int32_t *lo, const int32_t *hi,
+                                       partition_interval *out);
+
+/**
+ * instruction set the batched kernels were dispatched to at startup,
+ * the best one cpuid reports (PARTITION_TREE_ISA=sse|avx2 forces an older one)
+ */
+simd_isa partition_tree_isa(void);
+
+/**
+ * printable name of an instruction set
+ */
+const char *simd_isa_name(simd_isa isa);
+
+/**
+ * slots a level has room for with the given fanouts, and the bounds on
+ * the number of keys a tree with these fanouts can be built from
+ */
+int32_t num_keys_at_level(size_t level, int32_t *fanouts);
+int32_t max_num_keys(int32_t num_levels, int32_t *fanouts);
+int32_t min_num_keys(int32_t num_levels, int32_t *fanouts);
+
+/**
+ * slots each level of a tree over k keys needs at least, so that every
+ * node a search can reach exists, as the trimmed arena layout allocates;
+ * k must be within min_num_keys and max_num_keys
+ */
+void partition_tree_min_level_sizes(int32_t k, int32_t num_levels, int32_t *fanouts,
+                                    size_t *sizes);
+
+/**
+ * writes the tree's keys to keys (room for tree->num_keys) in sorted
+ * order, as they were passed to init_partition_tree; returns the count
+ */
+size_t partition_tree_keys(partition_tree *tree, int32_t *keys);
+
 /**
  * prints contents of the partition tree
  */
 void print_partition_tree(partition_tree *tree);
 
+/**
+ * number of int32 slots (keys and padding) allocated for a level
+ */
+size_t partition_tree_level_size(partition_tree *tree, int32_t level);
+
 /**
  * frees all resources associated with the given partition tree
  */
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "tree.h"
+#include "tree_kernels.h"
+
+// AVX2 primitives for the batched search template (see tree_batch.inc)
+// a 9-way node is one 256-bit compare, a 17-way node two
+typedef __m256i probe_vec;
+
+typedef struct {
+    __m256i A2H, I2P;
+} root_regs;
+
+static ALWAYS_INLINE probe_vec probe_broadcast(int32_t probe) {
+    return _mm256_set1_epi32(probe);
+}
+
+static ALWAYS_INLINE int32_t lane_mask(__m256i cmp) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(cmp));
+}
+
+static ALWAYS_INLINE void root_load(root_regs *root, const int32_t *node, const int32_t fanout) {
+    if (fanout == 5)
+        root->A2H = _mm256_castsi128_si256(_mm_load_si128((__m128i *) node));
+    else
+        root->A2H = _mm256_loadu_si256((__m256i *) node);
+    root->I2P = fanout > 9 ? _mm256_loadu_si256((__m256i *) (node + 8)) : _mm256_setzero_si256();
+}
+
+static ALWAYS_INLINE int32_t root_search(const root_regs *root, probe_vec p, const int32_t fanout) {
+    switch (fanout) {
+    case 5:
+        return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(_mm256_castsi256_si128(p), _mm256_castsi256_si128(root->A2H)))));
+    case 9:
+        return __builtin_popcount(lane_mask(_mm256_cmpgt_epi32(p, root->A2H)));
+    default:
+        return __builtin_popcount(lane_mask(_mm256_cmpgt_epi32(p, root->A2H)) |
+                                  lane_mask(_mm256_cmpgt_epi32(p, root->I2P)) << 8);
+    }
+}
+
+static ALWAYS_INLINE int32_t node_search(const int32_t *node, probe_vec p, const int32_t fanout) {
+    root_regs regs;
+    root_load(&regs, node, fanout);
+    return root_search(&regs, p, fanout);
+}
+
+#define BATCH_KERNEL_TABLE batch_kernels_avx2
+#include "tree_batch.inc"
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "tree.h"
+#include "tree_kernels.h"
+
+// AVX-512 primitives for the batched search template (see tree_batch.inc)
+// every node is a single masked compare, a 17-way node fills one zmm register
+typedef __m512i probe_vec;
+
+typedef struct {
+    __m512i A2P;
+} root_regs;
+
+static ALWAYS_INLINE probe_vec probe_broadcast(int32_t probe) {
+    return _mm512_set1_epi32(probe);
+}
+
+static ALWAYS_INLINE void root_load(root_regs *root, const int32_t *node, const int32_t fanout) {
+    switch (fanout) {
+    case 5:
+        root->A2P = _mm512_castsi128_si512(_mm_load_si128((__m128i *) node));
+        break;
+    case 9:
+        root->A2P = _mm512_castsi256_si512(_mm256_loadu_si256((__m256i *) node));
+        break;
+    default:
+        root->A2P = _mm512_loadu_si512(node);
+        break;
+    }
+}
+
+static ALWAYS_INLINE int32_t root_search(const root_regs *root, probe_vec p, const int32_t fanout) {
+    switch (fanout) {
+    case 5:
+        return __builtin_popcount(_mm_cmpgt_epi32_mask(_mm512_castsi512_si128(p),
+                                                       _mm512_castsi512_si128(root->A2P)));
+    case 9:
+        return __builtin_popcount(_mm256_cmpgt_epi32_mask(_mm512_castsi512_si256(p),
+                                                          _mm512_castsi512_si256(root->A2P)));
+    default:
+        return __builtin_popcount(_mm512_cmpgt_epi32_mask(p, root->A2P));
+    }
+}
+
+static ALWAYS_INLINE int32_t node_search(const int32_t *node, probe_vec p, const int32_t fanout) {
+    root_regs regs;
+    root_load(&regs, node, fanout);
+    return root_search(&regs, p, fanout);
+}
+
+#define BATCH_KERNEL_TABLE batch_kernels_avx512
+#include "tree_batch.inc"
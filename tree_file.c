@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tree.h"
+#include "tree_file.h"
+
+#define BYTE_ORDER_MARK 0x01020304
+
+static uint64_t align_up(uint64_t n, uint64_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// bytes of the fanouts and the per-level arrays after the header; the
+// fanouts are padded so the uint64_t arrays stay 8-byte aligned
+static uint64_t fanouts_size(int32_t num_levels) {
+    return align_up(num_levels * sizeof(int32_t), sizeof(uint64_t));
+}
+
+static uint64_t tables_size(int32_t num_levels) {
+    return fanouts_size(num_levels) + num_levels * 2 * sizeof(uint64_t);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+            return -1;
+        p   += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int save_partition_tree(partition_tree *tree, const char *path) {
+    int32_t  num_levels = tree->num_levels;
+    uint64_t offsets[num_levels];
+    uint64_t sizes[num_levels];
+    int32_t  i;
+
+    // level data starts after the header and the three per-level arrays
+    uint64_t pos = sizeof(tree_file_header) + tables_size(num_levels);
+    for (i = 0; i < num_levels; i++) {
+        pos        = align_up(pos, TREE_FILE_ALIGN);
+        offsets[i] = pos;
+        sizes[i]   = partition_tree_level_size(tree, i);
+        pos       += sizes[i] * sizeof(int32_t);
+    }
+
+    tree_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+    header.version    = TREE_FILE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.num_levels = num_levels;
+    header.num_keys   = tree->num_keys;
+    header.file_size  = pos;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    static const char zeros[TREE_FILE_ALIGN];
+    uint64_t written = sizeof(header) + tables_size(num_levels);
+    int err = write_all(fd, &header, sizeof(header)) ||
+              write_all(fd, tree->fanouts, num_levels * sizeof(int32_t)) ||
+              write_all(fd, zeros, fanouts_size(num_levels) - num_levels * sizeof(int32_t)) ||
+              write_all(fd, offsets, sizeof(offsets)) ||
+              write_all(fd, sizes, sizeof(sizes));
+
+    for (i = 0; i < num_levels && !err; i++) {
+        err = write_all(fd, zeros, offsets[i] - written) ||
+              write_all(fd, tree->nodes[i], sizes[i] * sizeof(int32_t));
+        written = offsets[i] + sizes[i] * sizeof(int32_t);
+    }
+
+    if (close(fd) < 0 || err)
+        return -1;
+    return 0;
+}
+
+int load_partition_tree(const char *path, partition_tree *tree) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(tree_file_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    char  *map  = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    tree_file_header *header = (tree_file_header *) map;
+    int32_t num_levels = header->num_levels;
+    if (memcmp(header->magic, TREE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TREE_FILE_VERSION ||
+        header->byte_order != BYTE_ORDER_MARK ||
+        header->file_size != size || num_levels < 1 ||
+        sizeof(tree_file_header) + tables_size(num_levels) > size) {
+        munmap(map, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    int32_t  *fanouts = (int32_t *) (map + sizeof(tree_file_header));
+    uint64_t *offsets = (uint64_t *) ((char *) fanouts + fanouts_size(num_levels));
+    uint64_t *sizes   = offsets + num_levels;
+    int32_t   i;
+
+    // the tree owns its fanouts, nodes points into the mapping
+    tree->num_levels   = num_levels;
+    tree->num_keys     = header->num_keys;
+    tree->fanouts      = malloc(sizeof(int32_t) * num_levels);
+    tree->nodes        = malloc(sizeof(int32_t *) * num_levels);
+    tree->level_sizes  = malloc(sizeof(size_t) * num_levels);
+    tree->alloc_flags  = TREE_ALLOC_ARENA;
+    tree->arena        = NULL;
+    tree->mapping      = map;
+    tree->mapping_size = size;
+    memcpy(tree->fanouts, fanouts, sizeof(int32_t) * num_levels);
+
+    for (i = 0; i < num_levels; i++) {
+        tree->nodes[i]       = (int32_t *) (map + offsets[i]);
+        tree->level_sizes[i] = sizes[i];
+    }
+
+    // levels may be trimmed (TREE_ALLOC_ARENA), but hold whole nodes and
+    // at least every node a search over num_keys keys can reach
+    int err = 0;
+    for (i = 0; i < num_levels; i++)
+        err |= tree->fanouts[i] < 2;
+    err = err || tree->num_keys < min_num_keys(num_levels, tree->fanouts) ||
+          tree->num_keys > max_num_keys(num_levels, tree->fanouts);
+    if (!err) {
+        size_t min_sizes[num_levels];
+        partition_tree_min_level_sizes(tree->num_keys, num_levels, tree->fanouts, min_sizes);
+        for (i = 0; i < num_levels; i++)
+            err |= offsets[i] % TREE_FILE_ALIGN != 0 || offsets[i] > size ||
+                   sizes[i] > (size - offsets[i]) / sizeof(int32_t) ||
+                   sizes[i] < min_sizes[i] || sizes[i] % (tree->fanouts[i] - 1) != 0;
+    }
+    if (err) {
+        destroy_partition_tree(tree);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "tree.h"
+
+// on-disk partition tree, loaded by mapping the file with no copying:
+//
+//   tree_file_header                    (64 bytes)
+//   int32_t  fanouts[num_levels]        (zero padded to a multiple of 8 bytes)
+//   uint64_t level_offsets[num_levels]  (bytes from the start of the file)
+//   uint64_t level_sizes[num_levels]    (int32 slots, padding included)
+//   levels, each starting on a TREE_FILE_ALIGN boundary
+//
+// all integers are native-endian, checked through byte_order on load
+
+#define TREE_FILE_MAGIC   "PARTTREE"
+#define TREE_FILE_VERSION 2
+#define TREE_FILE_ALIGN   64
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // 0x01020304 as written by the saving host
+    int32_t  num_levels;
+    int32_t  num_keys;
+    uint64_t file_size;
+    char     reserved[32];
+} tree_file_header;
+
+/**
+ * writes the tree to path in the format above
+ * returns 0 on success, -1 on error (with errno set)
+ */
+int save_partition_tree(partition_tree *tree, const char *path);
+
+/**
+ * maps a tree written by save_partition_tree read-only; the levels point
+ * straight into the mapping, so processes loading the same file share one
+ * page cache copy; destroy_partition_tree unmaps it
+ * returns 0 on success, -1 if the file can't be mapped or isn't a valid tree
+ */
+int load_partition_tree(const char *path, partition_tree *tree);
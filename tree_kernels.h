@@ -0,0 +1,111 @@
+#pragma once
+
+// internal to the tree implementation: batched search kernels generated
+// per fanout tuple, instantiated once per instruction set, and the node
+// compare shared with the other layouts (blocked_tree.c, radix_table.c)
+
+#include <smmintrin.h>
+
+#include "tree.h"
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// delimiters in the lanes keep of dels that are less than the probe p
+static ALWAYS_INLINE int32_t count_less(__m128i p, __m128i dels, int32_t keep) {
+    return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(p, dels))) & keep);
+}
+
+// lanes of the vector ending at the last of length delimiters that the
+// whole vectors up to delimiter j haven't counted yet
+static ALWAYS_INLINE int32_t tail_lanes(int32_t length, int32_t j) {
+    return (0xf << (4 - (length - j))) & 0xf;
+}
+
+// number of delimiters in a node of any length less than the probe;
+// whole vectors first, then one more vector ending at the node's last
+// delimiter with the lanes already counted masked off, so nothing past
+// the node is read and nodes need no padding to the vector width
+static ALWAYS_INLINE int32_t node_rank(const int32_t *node, int32_t length, int32_t probe) {
+    __m128i p   = _mm_set1_epi32(probe);
+    int32_t res = 0;
+    int32_t j;
+    for (j = 0; j + 4 <= length; j += 4)
+        res += count_less(p, _mm_loadu_si128((const __m128i *) (node + j)), 0xf);
+    if (j < length && length >= 4) {
+        res += count_less(p, _mm_loadu_si128((const __m128i *) (node + length - 4)),
+                          tail_lanes(length, j));
+    } else {
+        // fanouts 2-4, narrower than a vector
+        for (; j < length; j++)
+            res += node[j] < probe;
+    }
+    return res;
+}
+
+// node_rank of two probes in the same node, such as both bounds of an
+// interval, loading the node once
+static ALWAYS_INLINE void node_rank2(const int32_t *node, int32_t length, int32_t lo, int32_t hi,
+                                     int32_t *rank_lo, int32_t *rank_hi) {
+    __m128i plo = _mm_set1_epi32(lo);
+    __m128i phi = _mm_set1_epi32(hi);
+    int32_t a = 0, b = 0;
+    int32_t j;
+    for (j = 0; j + 4 <= length; j += 4) {
+        __m128i dels = _mm_loadu_si128((const __m128i *) (node + j));
+        a += count_less(plo, dels, 0xf);
+        b += count_less(phi, dels, 0xf);
+    }
+    if (j < length && length >= 4) {
+        __m128i dels = _mm_loadu_si128((const __m128i *) (node + length - 4));
+        a += count_less(plo, dels, tail_lanes(length, j));
+        b += count_less(phi, dels, tail_lanes(length, j));
+    } else {
+        for (; j < length; j++) {
+            a += node[j] < lo;
+            b += node[j] < hi;
+        }
+    }
+    *rank_lo = a;
+    *rank_hi = b;
+}
+
+// STEP(length) for a level of the given fanout, with a constant length
+// for the fanouts the kernels are generated for so node_rank is unrolled
+#define SWITCH_NODE_LENGTH(fanout, STEP)                                        \
+    switch (fanout) {                                                           \
+    case 5:  STEP(4);  break;                                                   \
+    case 9:  STEP(8);  break;                                                   \
+    case 17: STEP(16); break;                                                   \
+    default: STEP((fanout) - 1); break;                                         \
+    }
+
+typedef void (*batch_kernel)(partition_tree *, size_t, const int32_t *, int32_t *);
+
+typedef struct {
+    int32_t depth;
+    int32_t fanouts[4];
+    batch_kernel kernel;
+} batch_kernel_entry;
+
+// enumerates every fanout tuple of 5/9/17 with 1 to 4 levels as X(depth, f0, f1, f2, f3)
+#define FANOUT_TUPLES_4(X, a, b, c)                                   \
+    X(4, a, b, c, 5) X(4, a, b, c, 9) X(4, a, b, c, 17)
+#define FANOUT_TUPLES_3(X, a, b)                                      \
+    X(3, a, b, 5, 0) X(3, a, b, 9, 0) X(3, a, b, 17, 0)               \
+    FANOUT_TUPLES_4(X, a, b, 5) FANOUT_TUPLES_4(X, a, b, 9)           \
+    FANOUT_TUPLES_4(X, a, b, 17)
+#define FANOUT_TUPLES_2(X, a)                                         \
+    X(2, a, 5, 0, 0) X(2, a, 9, 0, 0) X(2, a, 17, 0, 0)               \
+    FANOUT_TUPLES_3(X, a, 5) FANOUT_TUPLES_3(X, a, 9)                 \
+    FANOUT_TUPLES_3(X, a, 17)
+#define FOR_EACH_FANOUT_TUPLE(X)                                      \
+    X(1, 5, 0, 0, 0) X(1, 9, 0, 0, 0) X(1, 17, 0, 0, 0)               \
+    FANOUT_TUPLES_2(X, 5) FANOUT_TUPLES_2(X, 9) FANOUT_TUPLES_2(X, 17)
+
+#define COUNT_FANOUT_TUPLE(depth, a, b, c, d) + 1
+enum { NUM_BATCH_KERNELS = 0 FOR_EACH_FANOUT_TUPLE(COUNT_FANOUT_TUPLE) };
+
+// one table per instruction set, in FOR_EACH_FANOUT_TUPLE order
+extern const batch_kernel_entry batch_kernels_sse[NUM_BATCH_KERNELS];
+extern const batch_kernel_entry batch_kernels_avx2[NUM_BATCH_KERNELS];
+extern const batch_kernel_entry batch_kernels_avx512[NUM_BATCH_KERNELS];
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <cpuid.h>
+
+#include "tune.h"
+#include "tree.h"
+#include "random.h"
+#include "util.h"
+
+// fanouts tried at each level: the generated kernels' and a 2-line node
+static const int32_t tune_fanouts_tried[] = { 5, 9, 17, 33 };
+#define NUM_FANOUTS_TRIED (sizeof(tune_fanouts_tried) / sizeof(tune_fanouts_tried[0]))
+// candidates kept of each depth
+#define TUNE_PER_DEPTH 2
+
+// assumed where the host doesn't say
+#define DEFAULT_L1D  (32 << 10)
+#define DEFAULT_L2   (256 << 10)
+#define DEFAULT_L3   (8 << 20)
+#define DEFAULT_DTLB 64
+#define DEFAULT_STLB 1536
+
+// a sysfs value such as "48K" or "105M", in bytes; 0 if unreadable
+static size_t read_size(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    unsigned long value = 0;
+    char unit = 0;
+    int n = fscanf(f, "%lu%c", &value, &unit);
+    fclose(f);
+    if (n < 1)
+        return 0;
+    if (unit == 'K')
+        value <<= 10;
+    else if (unit == 'M')
+        value <<= 20;
+    return value;
+}
+
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char *ok = fgets(buf, size, f);
+    fclose(f);
+    if (!ok)
+        return -1;
+    buf[strcspn(buf, "\n")] = 0;
+    return 0;
+}
+
+void read_cache_topology(cache_topology *topo) {
+    memset(topo, 0, sizeof(*topo));
+
+    // one directory per cache of cpu0
+    int32_t i;
+    for (i = 0; i < 16; i++) {
+        char path[128], type[32], level[8];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (read_line(path, type, sizeof(type)) < 0)
+            break;
+        if (strcmp(type, "Instruction") == 0)
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        if (read_line(path, level, sizeof(level)) < 0)
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        size_t size = read_size(path);
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu0/cache/index%d/coherency_line_size", i);
+        size_t line = read_size(path);
+
+        switch (atoi(level)) {
+        case 1: topo->l1d = size; break;
+        case 2: topo->l2  = size; break;
+        case 3: topo->l3  = size; break;
+        }
+        if (line)
+            topo->line = line;
+    }
+
+    // deterministic address translation parameters, Intel only; each
+    // subleaf is one TLB, with the page sizes it holds
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 0x18)
+        return;
+    __cpuid_count(0x18, 0, eax, ebx, ecx, edx);
+    unsigned int last = eax, sub;
+    for (sub = 0; sub <= last; sub++) {
+        __cpuid_count(0x18, sub, eax, ebx, ecx, edx);
+        unsigned int type  = edx & 0x1f;   // 1 data, 2 instruction, 3 unified
+        unsigned int level = (edx >> 5) & 0x7;
+        if ((type != 1 && type != 3) || !(ebx & 1))
+            continue;
+        int32_t entries = (ebx >> 16) * ecx;
+        if (level == 1)
+            topo->dtlb += entries;
+        else if (level == 2)
+            topo->stlb += entries;
+    }
+}
+
+void print_cache_topology(const cache_topology *topo) {
+    printf("caches: L1d %zuKB, L2 %zuKB, L3 %zuKB, %zu-byte lines\n", topo->l1d >> 10,
+           topo->l2 >> 10, topo->l3 >> 10, topo->line);
+    if (topo->dtlb || topo->stlb)
+        printf("TLBs: %d L1 and %d L2 entries for 4KB pages\n", topo->dtlb, topo->stlb);
+    else
+        printf("TLBs: not reported, assuming %d L1 and %d L2 entries\n", DEFAULT_DTLB,
+               DEFAULT_STLB);
+}
+
+// rough cycles per probe: each level pays for its compares and for the
+// innermost cache, and TLB, the levels down to it fit in
+static double model_cost(const cache_topology *topo, int32_t num_keys, int32_t num_levels,
+                         const int32_t *fanouts) {
+    size_t l1d  = topo->l1d ? topo->l1d : DEFAULT_L1D;
+    size_t l2   = topo->l2 ? topo->l2 : DEFAULT_L2;
+    size_t l3   = topo->l3 ? topo->l3 : DEFAULT_L3;
+    size_t dtlb = (size_t) (topo->dtlb ? topo->dtlb : DEFAULT_DTLB) << 12;
+    size_t stlb = (size_t) (topo->stlb ? topo->stlb : DEFAULT_STLB) << 12;
+
+    // the generated kernels keep the root in registers
+    int32_t kernel = num_levels <= 4, l;
+    for (l = 0; l < num_levels; l++)
+        if (fanouts[l] != 5 && fanouts[l] != 9 && fanouts[l] != 17)
+            kernel = 0;
+
+    double  cost  = 0.0;
+    size_t  bytes = 0;
+    int64_t nodes = 1;
+    for (l = 0; l < num_levels; l++) {
+        int64_t slots = nodes * (fanouts[l] - 1);
+        bytes += sizeof(int32_t) * (slots < num_keys ? slots : num_keys);
+        nodes *= fanouts[l];
+
+        // the generic search neither unrolls nor keeps the root in registers
+        cost += (fanouts[l] + 2) / 4 + (kernel ? 0 : 8);
+        if (l == 0 && kernel)
+            continue;
+        cost += bytes <= l1d ? 4 : bytes <= l2 ? 14 : bytes <= l3 ? 40 : 200;
+        if (bytes > dtlb)
+            cost += bytes > stlb ? 30 : 7;
+    }
+    return cost;
+}
+
+typedef struct {
+    int32_t num_levels;
+    int32_t fanouts[TUNE_MAX_LEVELS];
+    double  cost;
+} candidate;
+
+// keeps the limit cheapest shapes, sorted by cost
+static void consider(candidate *best, int32_t *num_best, int32_t limit, const candidate *c) {
+    int32_t i = *num_best < limit ? (*num_best)++ : limit;
+    if (i == limit && c->cost >= best[limit - 1].cost)
+        return;
+    if (i == limit)
+        i--;
+    while (i > 0 && best[i - 1].cost > c->cost) {
+        best[i] = best[i - 1];
+        i--;
+    }
+    best[i] = *c;
+}
+
+// every tuple of depth levels the tree accepts num_keys for: the levels
+// below the root hold fewer keys (min_num_keys), and all of them more
+// (max_num_keys); fanouts are chosen from the bottom up, so a partial
+// product already above num_keys prunes the rest
+static void enumerate(const cache_topology *topo, int32_t num_keys, int32_t depth,
+                      int32_t level, int64_t below, candidate *c,
+                      candidate *best, int32_t *num_best) {
+    size_t i;
+    for (i = 0; i < NUM_FANOUTS_TRIED; i++) {
+        int32_t fanout = tune_fanouts_tried[i];
+        c->fanouts[level] = fanout;
+        if (level > 0) {
+            if (below * fanout <= num_keys)
+                enumerate(topo, num_keys, depth, level - 1, below * fanout, c, best, num_best);
+        } else if (below * fanout - 1 >= num_keys) {
+            c->cost = model_cost(topo, num_keys, depth, c->fanouts);
+            consider(best, num_best, TUNE_PER_DEPTH, c);
+        }
+    }
+}
+
+// best of TUNE_RUNS runs in probes per second
+static double time_shape(int32_t num_keys, int32_t *keys, candidate *c,
+                         const int32_t *probes, int32_t *ranges) {
+    partition_tree tree;
+    init_partition_tree(num_keys, keys, c->num_levels, c->fanouts, &tree);
+
+    double best = 0.0;
+    int32_t r;
+    for (r = 0; r < TUNE_RUNS; r++) {
+        double start = now();
+        binary_search_partition_lookup(&tree, TUNE_PROBES, probes, ranges);
+        double elapsed = now() - start;
+        if (best == 0.0 || elapsed < best)
+            best = elapsed;
+    }
+
+    destroy_partition_tree(&tree);
+    return TUNE_PROBES / best;
+}
+
+static void format_fanouts(char *buf, size_t size, int32_t num_levels, const int32_t *fanouts) {
+    size_t used = 0;
+    int32_t l;
+    buf[0] = 0;
+    for (l = 0; l < num_levels && used < size; l++)
+        used += snprintf(buf + used, size - used, l ? "-%d" : "%d", fanouts[l]);
+}
+
+// a line of the tune file:
+//   <num keys> <isa> <L1d> <L2> <L3> <probes/s> <num levels> <fanouts...>
+static int32_t find_recorded(const char *path, int32_t num_keys, const cache_topology *topo,
+                             int32_t *fanouts) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[512], isa[16];
+    int32_t found = -1;
+    while (found < 0 && fgets(line, sizeof(line), f)) {
+        long keys;
+        size_t l1d, l2, l3;
+        double rate;
+        int32_t levels, l, pos, n;
+        if (sscanf(line, "%ld %15s %zu %zu %zu %lf %d%n", &keys, isa, &l1d, &l2, &l3, &rate,
+                   &levels, &pos) != 7)
+            continue;
+        if (keys != num_keys || strcmp(isa, simd_isa_name(partition_tree_isa())) ||
+            l1d != topo->l1d || l2 != topo->l2 || l3 != topo->l3 ||
+            levels < 1 || levels > TUNE_MAX_LEVELS)
+            continue;
+        for (l = 0; l < levels; l++) {
+            if (sscanf(line + pos, "%d%n", &fanouts[l], &n) != 1 || fanouts[l] < 2)
+                break;
+            pos += n;
+        }
+        if (l == levels)
+            found = levels;
+    }
+    fclose(f);
+    return found;
+}
+
+static void record(const char *path, int32_t num_keys, const cache_topology *topo,
+                   const candidate *c, double rate) {
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "%d %s %zu %zu %zu %.0f %d", num_keys, simd_isa_name(partition_tree_isa()),
+            topo->l1d, topo->l2, topo->l3, rate, c->num_levels);
+    int32_t l;
+    for (l = 0; l < c->num_levels; l++)
+        fprintf(f, " %d", c->fanouts[l]);
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+int32_t tune_fanouts(int32_t num_keys, int32_t *keys, const cache_topology *topo,
+                     const char *path, int32_t *fanouts) {
+    char shape[TUNE_MAX_LEVELS * 4 + 1];
+    int32_t levels;
+    if (path && (levels = find_recorded(path, num_keys, topo, fanouts)) > 0) {
+        format_fanouts(shape, sizeof(shape), levels, fanouts);
+        printf("tune: %s recorded in %s\n", shape, path);
+        return levels;
+    }
+
+    // the cheapest few of each depth, so that shapes the model can't tell
+    // apart don't all come from one depth, then the cheapest of those
+    candidate best[TUNE_CANDIDATES], c, of_depth[TUNE_PER_DEPTH];
+    int32_t num_best = 0, depth, i;
+    for (depth = 1; depth <= TUNE_MAX_LEVELS; depth++) {
+        int32_t num_of_depth = 0;
+        c.num_levels = depth;
+        enumerate(topo, num_keys, depth, depth - 1, 1, &c, of_depth, &num_of_depth);
+        for (i = 0; i < num_of_depth; i++)
+            consider(best, &num_best, TUNE_CANDIDATES, &of_depth[i]);
+    }
+    if (num_best == 0)
+        return -1;
+
+    // the same probes for every shape
+    rand32_t *gen     = rand32_init(4112);
+    int32_t  *probes  = malloc(sizeof(int32_t) * TUNE_PROBES);
+    int32_t  *ranges  = malloc(sizeof(int32_t) * TUNE_PROBES);
+    if (!probes || !ranges) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < TUNE_PROBES; i++)
+        probes[i] = rand32_next(gen);
+
+    int32_t fastest = 0;
+    double  rates[TUNE_CANDIDATES];
+    for (i = 0; i < num_best; i++) {
+        rates[i] = time_shape(num_keys, keys, &best[i], probes, ranges);
+        if (rates[i] > rates[fastest])
+            fastest = i;
+        format_fanouts(shape, sizeof(shape), best[i].num_levels, best[i].fanouts);
+        printf("tune: %-24s model %5.0f, %8.2f M probes/s\n", shape, best[i].cost,
+               rates[i] / 1e6);
+    }
+
+    format_fanouts(shape, sizeof(shape), best[fastest].num_levels, best[fastest].fanouts);
+    printf("tune: picked %s\n", shape);
+    if (path)
+        record(path, num_keys, topo, &best[fastest], rates[fastest]);
+
+    memcpy(fanouts, best[fastest].fanouts, sizeof(int32_t) * best[fastest].num_levels);
+    free(gen);
+    free(probes);
+    free(ranges);
+    return best[fastest].num_levels;
+}
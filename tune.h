@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// automatic choice of fanouts for a key count
+//
+// fanout tuples of up to TUNE_MAX_LEVELS levels that can hold the keys,
+// each fanout taken from tune_fanouts_tried in tune.c (5, 9, 17, 33), are
+// ranked with a cost model of the host's caches and TLBs: each level
+// costs more the further out the levels above and including it spill,
+// plus its compares. Only the TUNE_PER_DEPTH (2) cheapest of each depth
+// are kept, so shapes of one depth can't crowd out the others, and the
+// TUNE_CANDIDATES cheapest of those are built over the actual keys and
+// timed with binary_search_partition_lookup on TUNE_PROBES random probes;
+// the fastest wins. The choice can be recorded in a file, keyed by key
+// count, instruction set and cache sizes, so later runs on the same host
+// reuse it without benchmarking.
+
+#define TUNE_MAX_LEVELS 8
+// shapes benchmarked, the cheapest by the model
+#define TUNE_CANDIDATES 8
+// probes per timed run, best of TUNE_RUNS
+#define TUNE_PROBES (1 << 20)
+#define TUNE_RUNS   3
+
+typedef struct {
+    size_t  l1d, l2, l3;    // data cache bytes, 0 if unknown
+    size_t  line;           // cache line bytes
+    int32_t dtlb;           // first level data TLB entries for 4KB pages, 0 if unknown
+    int32_t stlb;           // second level TLB entries for 4KB pages, 0 if unknown
+} cache_topology;
+
+/**
+ * reads the cache sizes from sysfs and the TLB sizes from cpuid leaf
+ * 0x18, where the host reports them
+ */
+void read_cache_topology(cache_topology *topo);
+
+/**
+ * prints what read_cache_topology found
+ */
+void print_cache_topology(const cache_topology *topo);
+
+/**
+ * picks fanouts for a tree over num_keys sorted keys, writing them to
+ * fanouts (room for TUNE_MAX_LEVELS) and returning the number of levels;
+ * with path, a choice recorded there for the same key count and host is
+ * reused, and a new one is appended; returns -1 if no candidate fits
+ */
+int32_t tune_fanouts(int32_t num_keys, int32_t *keys, const cache_topology *topo,
+                     const char *path, int32_t *fanouts);
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <smmintrin.h>
+#include <nmmintrin.h>
+
+#include "tree.h"
+#include "typed_tree.h"
+#include "verify.h"
+
+#define TYPED_CAT(f, name)  TYPED_CAT2(f, name)
+#define TYPED_CAT2(f, name) f##_##name
+
+static const char *key_type_names[NUM_KEY_TYPES] = { "int32", "int64", "int16", "float" };
+
+int32_t parse_key_type(const char *name) {
+    int32_t i;
+    for (i = 0; i < NUM_KEY_TYPES; i++)
+        if (strcmp(name, key_type_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+// allocates memory aligned at 16-byte boundary
+static void *aligned_alloc_or_die(size_t size) {
+    void *ptr;
+    if (posix_memalign(&ptr, 16, size)) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void check_num_keys(int32_t k, int32_t num_levels, int32_t *fanouts) {
+    if (k > max_num_keys(num_levels, fanouts)) {
+        fprintf(stderr, "error: too many build keys for partition tree, maximum %d keys\n",
+                max_num_keys(num_levels, fanouts));
+        exit(EXIT_FAILURE);
+    }
+
+    if (k < min_num_keys(num_levels, fanouts)) {
+        fprintf(stderr, "error: too few build keys for partition tree, minimum %d keys\n",
+                min_num_keys(num_levels, fanouts));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// level each sorted key goes to, filling the tree bottom-up
+static void place_levels(int32_t k, int32_t num_levels, int32_t *fanouts, int32_t *levels) {
+    // boolean indicating whether each level just had a node filled
+    int32_t filled[num_levels];
+    size_t  tails[num_levels];
+
+    int32_t i, j;
+    for (j = 0; j < num_levels; j++) {
+        filled[j] = 0;
+        tails[j]  = 0;
+    }
+
+    for (i = 0; i < k; i++) {
+        for (j = num_levels - 1; j >= 0; j--) {
+            if (filled[j]) {
+                // go up one level and clear the filled bit
+                filled[j] = 0;
+                continue;
+            }
+            levels[i] = j;
+            if (++tails[j] % (fanouts[j] - 1) == 0)
+                filled[j] = 1;
+            break;
+        }
+    }
+}
+
+// 64-bit keys, 2 per compare (SSE4.2 pcmpgtq)
+#define KEY_NAME              i64
+#define KEY_T                 int64_t
+#define KEY_MAX               INT64_MAX
+#define KEY_LANES             2
+#define KEY_VEC               __m128i
+#define KEY_BROADCAST(x)      _mm_set1_epi64x(x)
+#define KEY_LOADU(ptr)        _mm_loadu_si128((const __m128i *) (ptr))
+#define KEY_CMPGT_MASK(p, d)  _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(p, d)))
+#define KEY_FROM_INT32(x)     ((int64_t) (x) * (1 << 24))
+#include "typed_tree.inc"
+#undef KEY_NAME
+#undef KEY_T
+#undef KEY_MAX
+#undef KEY_LANES
+#undef KEY_VEC
+#undef KEY_BROADCAST
+#undef KEY_LOADU
+#undef KEY_CMPGT_MASK
+#undef KEY_FROM_INT32
+
+// 16-bit keys, 8 per compare; the compare is packed to one byte per lane
+#define KEY_NAME              i16
+#define KEY_T                 int16_t
+#define KEY_MAX               INT16_MAX
+#define KEY_LANES             8
+#define KEY_VEC               __m128i
+#define KEY_BROADCAST(x)      _mm_set1_epi16(x)
+#define KEY_LOADU(ptr)        _mm_loadu_si128((const __m128i *) (ptr))
+#define KEY_CMPGT_MASK(p, d)  _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(p, d), \
+                                                                _mm_setzero_si128()))
+#define KEY_FROM_INT32(x)     ((int16_t) ((x) >> 16))
+#include "typed_tree.inc"
+#undef KEY_NAME
+#undef KEY_T
+#undef KEY_MAX
+#undef KEY_LANES
+#undef KEY_VEC
+#undef KEY_BROADCAST
+#undef KEY_LOADU
+#undef KEY_CMPGT_MASK
+#undef KEY_FROM_INT32
+
+// float keys, 4 per compare; NaN probes compare false and go to range 0
+#define KEY_NAME              f32
+#define KEY_T                 float
+#define KEY_MAX               INFINITY
+#define KEY_LANES             4
+#define KEY_VEC               __m128
+#define KEY_BROADCAST(x)      _mm_set1_ps(x)
+#define KEY_LOADU(ptr)        _mm_loadu_ps(ptr)
+#define KEY_CMPGT_MASK(p, d)  _mm_movemask_ps(_mm_cmpgt_ps(p, d))
+#define KEY_FROM_INT32(x)     ((float) (x))
+#include "typed_tree.inc"
+#undef KEY_NAME
+#undef KEY_T
+#undef KEY_MAX
+#undef KEY_LANES
+#undef KEY_VEC
+#undef KEY_BROADCAST
+#undef KEY_LOADU
+#undef KEY_CMPGT_MASK
+#undef KEY_FROM_INT32
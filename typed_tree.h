@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+// partition trees over other key types: int64 (i64), int16 (i16) and
+// float (f32), with the same layout and range semantics as partition_tree
+// levels are padded with INT64_MAX, INT16_MAX and +inf respectively; the
+// SIMD search compares 2, 8 and 4 keys per 128-bit instruction, so a
+// 9-way int16 node is a single compare
+
+// key types the drivers can build a tree over
+typedef enum {
+    KEY_INT32,
+    KEY_INT64,
+    KEY_INT16,
+    KEY_FLOAT,
+    NUM_KEY_TYPES
+} key_type;
+
+/**
+ * key type by name (int32, int64, int16, float), or -1
+ */
+int32_t parse_key_type(const char *name);
+
+/**
+ * for each key type name (suffix) and C type:
+ *
+ * init_partition_tree_<name>: builds a tree from k sorted unique keys,
+ *   with the same bounds on k as init_partition_tree
+ * binary_search_partition_<name>: partition of one probe, binary search
+ * binary_search_partition_simd_<name>: partition of one probe, SIMD compares
+ * binary_search_partition_batch_<name>: partitions of num_probes probes,
+ *   4 at a time interleaved per level
+ * verify_ranges_<name>: checks ranges against the sorted keys as
+ *   verify_ranges does, with a binary search per checked probe
+ * keys_from_int32_<name>: maps generated int32 keys or probes to the key
+ *   type, order preserving; with unique set, keys that collide after the
+ *   mapping (int16, float) are dropped, returns the number written
+ * destroy_partition_tree_<name>: frees the tree
+ */
+#define DECLARE_TYPED_TREE(name, key_t)                                             \
+    typedef struct {                                                                \
+        int32_t  num_levels;                                                        \
+        int32_t  num_keys;                                                          \
+        int32_t *fanouts;                                                           \
+        key_t  **nodes;                                                             \
+        size_t  *level_sizes;  /* key slots of each level, padding included */      \
+    } partition_tree_##name;                                                        \
+                                                                                    \
+    void init_partition_tree_##name(int32_t k, const key_t *keys,                   \
+                                    int32_t num_levels, int32_t fanouts[],          \
+                                    partition_tree_##name *tree);                   \
+    void binary_search_partition_##name(partition_tree_##name *tree, key_t probe,   \
+                                        int32_t *range);                            \
+    void binary_search_partition_simd_##name(partition_tree_##name *tree,           \
+                                             key_t probe, int32_t *range);          \
+    void binary_search_partition_batch_##name(partition_tree_##name *tree,          \
+                                              size_t num_probes,                    \
+                                              const key_t *probes, int32_t *ranges);\
+    size_t verify_ranges_##name(int32_t num_keys, const key_t *keys,                \
+                                size_t num_probes, const key_t *probes,             \
+                                const int32_t *ranges, size_t sample,               \
+                                size_t *num_checked);                               \
+    size_t keys_from_int32_##name(size_t n, const int32_t *src, key_t *dst,         \
+                                  int32_t unique);                                  \
+    void destroy_partition_tree_##name(partition_tree_##name *tree);
+
+DECLARE_TYPED_TREE(i64, int64_t)
+DECLARE_TYPED_TREE(i16, int16_t)
+DECLARE_TYPED_TREE(f32, float)
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "updatable.h"
+#include "tree.h"
+#include "util.h"
+
+enum { UPDATE_INSERT, UPDATE_DELETE };
+
+// base tree shared by the snapshots built on it
+struct tree_base {
+    partition_tree tree;
+    int32_t       *keys;      // the tree's delimiters in sorted order
+    int32_t        num_keys;
+    int32_t        refs;
+};
+
+// number of elements of the sorted array less than key
+static int32_t lower_bound(const int32_t *array, int32_t n, int32_t key) {
+    int32_t lo = 0, hi = n;
+    while (lo < hi) {
+        int32_t middle = (lo + hi) / 2;
+        if (array[middle] < key)
+            lo = middle + 1;
+        else
+            hi = middle;
+    }
+    return lo;
+}
+
+static int32_t contains(const int32_t *array, int32_t n, int32_t key) {
+    int32_t i = lower_bound(array, n, key);
+    return i < n && array[i] == key;
+}
+
+// copy of the sorted array with key added (add) or removed
+static int32_t *copy_with(const int32_t *array, int32_t n, int32_t key, int32_t add) {
+    int32_t *copy = malloc_or_die(sizeof(int32_t) * (n + 1));
+    int32_t  i    = lower_bound(array, n, key);
+    memcpy(copy, array, sizeof(int32_t) * i);
+    if (add) {
+        copy[i] = key;
+        memcpy(copy + i + 1, array + i, sizeof(int32_t) * (n - i));
+    } else {
+        memcpy(copy + i, array + i + 1, sizeof(int32_t) * (n - i - 1));
+    }
+    return copy;
+}
+
+static void release_base(tree_base *base) {
+    if (__atomic_sub_fetch(&base->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    destroy_partition_tree(&base->tree);
+    free(base->keys);
+    free(base);
+}
+
+// snapshot owning the given delta arrays, with one reference; the arrays
+// are never NULL, so they can be copied without special cases
+static tree_snapshot *new_snapshot(tree_base *base, int32_t *inserts, int32_t num_inserts,
+                                   int32_t *deletes, int32_t num_deletes) {
+    tree_snapshot *s = malloc_or_die(sizeof(tree_snapshot));
+    __atomic_add_fetch(&base->refs, 1, __ATOMIC_RELAXED);
+    s->base        = base;
+    s->inserts     = inserts;
+    s->num_inserts = num_inserts;
+    s->deletes     = deletes;
+    s->num_deletes = num_deletes;
+    s->refs        = 1;
+    return s;
+}
+
+void release_snapshot(tree_snapshot *s) {
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    release_base(s->base);
+    free(s->inserts);
+    free(s->deletes);
+    free(s);
+}
+
+tree_snapshot *acquire_snapshot(updatable_tree *u) {
+    // under the lock, so the snapshot can't be released in between
+    pthread_mutex_lock(&u->lock);
+    tree_snapshot *s = u->current;
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&u->lock);
+    return s;
+}
+
+// new snapshot with one update applied to old, or NULL with errno set
+static tree_snapshot *apply_update(tree_snapshot *old, int32_t key, int32_t op) {
+    tree_base *base = old->base;
+    int32_t    ni = old->num_inserts, nd = old->num_deletes;
+    int32_t   *inserts = NULL, *deletes = NULL;
+
+    if (op == UPDATE_INSERT) {
+        if (contains(old->deletes, nd, key)) {
+            // re-inserting a deleted base key
+            deletes = copy_with(old->deletes, nd--, key, 0);
+        } else if (contains(base->keys, base->num_keys, key) ||
+                   contains(old->inserts, ni, key)) {
+            errno = EEXIST;
+            return NULL;
+        } else if (ni + nd >= DELTA_MAX_KEYS) {
+            errno = EAGAIN;
+            return NULL;
+        } else {
+            inserts = copy_with(old->inserts, ni++, key, 1);
+        }
+    } else {
+        if (contains(old->inserts, ni, key)) {
+            // deleting a key that only lives in the delta
+            inserts = copy_with(old->inserts, ni--, key, 0);
+        } else if (!contains(base->keys, base->num_keys, key) ||
+                   contains(old->deletes, nd, key)) {
+            errno = ENOENT;
+            return NULL;
+        } else if (ni + nd >= DELTA_MAX_KEYS) {
+            errno = EAGAIN;
+            return NULL;
+        } else {
+            deletes = copy_with(old->deletes, nd++, key, 1);
+        }
+    }
+
+    // the side that didn't change is copied as is
+    if (!inserts) {
+        inserts = malloc_or_die(sizeof(int32_t) * ni);
+        memcpy(inserts, old->inserts, sizeof(int32_t) * ni);
+    }
+    if (!deletes) {
+        deletes = malloc_or_die(sizeof(int32_t) * nd);
+        memcpy(deletes, old->deletes, sizeof(int32_t) * nd);
+    }
+    return new_snapshot(base, inserts, ni, deletes, nd);
+}
+
+static int32_t delta_size(tree_snapshot *s) {
+    return s->num_inserts + s->num_deletes;
+}
+
+// replaces the current snapshot, called with the lock held
+static void publish(updatable_tree *u, tree_snapshot *s) {
+    tree_snapshot *old = u->current;
+    u->current = s;
+    release_snapshot(old);
+}
+
+static int update(updatable_tree *u, int32_t key, int32_t op) {
+    pthread_mutex_lock(&u->lock);
+    tree_snapshot *s = apply_update(u->current, key, op);
+    if (!s) {
+        pthread_mutex_unlock(&u->lock);
+        return -1;
+    }
+    publish(u, s);
+    u->num_updates++;
+
+    // the merge thread replays these on the base it is building
+    if (u->merging) {
+        if (u->log_size + 2 > u->log_capacity) {
+            u->log_capacity = u->log_capacity ? u->log_capacity * 2 : 1024;
+            u->log = realloc(u->log, sizeof(int32_t) * u->log_capacity);
+        }
+        u->log[u->log_size++] = key;
+        u->log[u->log_size++] = op;
+    }
+
+    if (delta_size(s) >= DELTA_MERGE_KEYS && !u->merging)
+        pthread_cond_signal(&u->wake);
+    pthread_mutex_unlock(&u->lock);
+    return 0;
+}
+
+int updatable_tree_insert(updatable_tree *u, int32_t key) {
+    return update(u, key, UPDATE_INSERT);
+}
+
+int updatable_tree_delete(updatable_tree *u, int32_t key) {
+    return update(u, key, UPDATE_DELETE);
+}
+
+// new base tree with the delta of s merged in, or NULL if the key count
+// no longer fits the fanouts
+static tree_base *merge_base(tree_snapshot *s) {
+    tree_base *old = s->base;
+    int32_t    num_levels = old->tree.num_levels;
+    int32_t   *fanouts    = old->tree.fanouts;
+    int32_t    n = old->num_keys + s->num_inserts - s->num_deletes;
+
+    if (n > max_num_keys(num_levels, fanouts) || n < min_num_keys(num_levels, fanouts))
+        return NULL;
+
+    // base keys minus the deleted ones, merged with the inserted ones
+    int32_t *keys = malloc_or_die(sizeof(int32_t) * n);
+    int32_t  i = 0, j = 0, d = 0, k = 0;
+    while (i < old->num_keys || j < s->num_inserts) {
+        if (j == s->num_inserts || (i < old->num_keys && old->keys[i] < s->inserts[j])) {
+            if (d < s->num_deletes && s->deletes[d] == old->keys[i])
+                d++;
+            else
+                keys[k++] = old->keys[i];
+            i++;
+        } else {
+            keys[k++] = s->inserts[j++];
+        }
+    }
+
+    // huge pages that fell back to THP are asked for again
+    int32_t flags = old->tree.alloc_flags;
+    if (flags & TREE_ALLOC_THP)
+        flags = (flags & ~TREE_ALLOC_THP) | TREE_ALLOC_HUGE_2MB;
+
+    tree_base *base = malloc_or_die(sizeof(tree_base));
+    init_partition_tree_alloc(n, keys, num_levels, fanouts, flags, &base->tree);
+    base->keys     = keys;
+    base->num_keys = n;
+    base->refs     = 0;
+    return base;
+}
+
+static void *merge_main(void *arg) {
+    updatable_tree *u = arg;
+
+    pthread_mutex_lock(&u->lock);
+    for (;;) {
+        while (!u->stop && (delta_size(u->current) == 0 || u->stuck_at == u->num_updates ||
+                            (delta_size(u->current) < DELTA_MERGE_KEYS && !u->flush_pending)))
+            pthread_cond_wait(&u->wake, &u->lock);
+        if (u->stop)
+            break;
+
+        tree_snapshot *s = u->current;
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+        u->merging  = 1;
+        u->log_size = 0;
+        pthread_mutex_unlock(&u->lock);
+
+        // the expensive part runs while updates and searches go on
+        tree_base *base = merge_base(s);
+
+        pthread_mutex_lock(&u->lock);
+        if (base) {
+            tree_snapshot *merged = new_snapshot(base, malloc_or_die(0), 0, malloc_or_die(0), 0);
+            size_t i;
+            for (i = 0; i < u->log_size; i += 2) {
+                tree_snapshot *next = apply_update(merged, u->log[i], u->log[i+1]);
+                if (next) {
+                    release_snapshot(merged);
+                    merged = next;
+                }
+            }
+            publish(u, merged);
+            u->num_merges++;
+        } else {
+            u->stuck_at = u->num_updates;
+        }
+        u->merging       = 0;
+        u->flush_pending = 0;
+        pthread_cond_broadcast(&u->merged);
+        release_snapshot(s);
+    }
+    pthread_mutex_unlock(&u->lock);
+    return NULL;
+}
+
+void init_updatable_tree(partition_tree *tree, updatable_tree *u) {
+    tree_base *base = malloc_or_die(sizeof(tree_base));
+    base->tree     = *tree;
+    base->keys     = malloc_or_die(sizeof(int32_t) * tree->num_keys);
+    base->num_keys = partition_tree_keys(tree, base->keys);
+    base->refs     = 0;
+
+    pthread_mutex_init(&u->lock, NULL);
+    pthread_cond_init(&u->wake, NULL);
+    pthread_cond_init(&u->merged, NULL);
+    u->current       = new_snapshot(base, malloc_or_die(0), 0, malloc_or_die(0), 0);
+    u->merging       = 0;
+    u->stop          = 0;
+    u->flush_pending = 0;
+    u->log           = NULL;
+    u->log_size      = 0;
+    u->log_capacity  = 0;
+    u->num_updates   = 0;
+    u->num_merges    = 0;
+    u->stuck_at      = SIZE_MAX;
+
+    if (pthread_create(&u->merge_thread, NULL, merge_main, u)) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void snapshot_search(tree_snapshot *s, size_t num_probes,
+                     const int32_t *probes, int32_t *ranges) {
+    binary_search_partition_batch(&s->base->tree, num_probes, probes, ranges);
+    if (delta_size(s) == 0)
+        return;
+
+    size_t i;
+    for (i = 0; i < num_probes; i++)
+        ranges[i] += lower_bound(s->inserts, s->num_inserts, probes[i]) -
+                     lower_bound(s->deletes, s->num_deletes, probes[i]);
+}
+
+int32_t snapshot_num_keys(tree_snapshot *s) {
+    return s->base->num_keys + s->num_inserts - s->num_deletes;
+}
+
+void updatable_tree_flush(updatable_tree *u) {
+    pthread_mutex_lock(&u->lock);
+    while (delta_size(u->current) > 0 && u->stuck_at != u->num_updates) {
+        u->flush_pending = 1;
+        pthread_cond_signal(&u->wake);
+        pthread_cond_wait(&u->merged, &u->lock);
+    }
+    pthread_mutex_unlock(&u->lock);
+}
+
+void destroy_updatable_tree(updatable_tree *u) {
+    pthread_mutex_lock(&u->lock);
+    u->stop = 1;
+    pthread_cond_signal(&u->wake);
+    pthread_mutex_unlock(&u->lock);
+    pthread_join(u->merge_thread, NULL);
+
+    release_snapshot(u->current);
+    free(u->log);
+    pthread_mutex_destroy(&u->lock);
+    pthread_cond_destroy(&u->wake);
+    pthread_cond_destroy(&u->merged);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "tree.h"
+
+// partition tree with delimiters inserted and deleted in place
+//
+// updates go to a small sorted delta (keys inserted into and deleted from
+// the base tree) that is searched alongside the tree: the range of a probe
+// is its range in the base tree, plus the inserted keys less than it,
+// minus the deleted keys less than it. Every update publishes a new
+// immutable snapshot of base and delta, so searches running on an older
+// snapshot keep seeing consistent delimiters. Once the delta holds
+// DELTA_MERGE_KEYS keys a background thread rebuilds the base tree with
+// the delta merged in, replays the updates that arrived meanwhile, and
+// swaps the new snapshot in.
+
+// delta size that wakes the merge thread
+#define DELTA_MERGE_KEYS 256
+// delta size at which updates fail with EAGAIN until a merge catches up
+#define DELTA_MAX_KEYS   8192
+
+typedef struct tree_base tree_base;
+
+typedef struct {
+    tree_base *base;
+    int32_t    num_inserts;
+    int32_t    num_deletes;
+    int32_t   *inserts;     // sorted, not in the base tree
+    int32_t   *deletes;     // sorted, in the base tree
+    int32_t    refs;
+} tree_snapshot;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;          // merge thread waits on it
+    pthread_cond_t  merged;        // flush waits on it
+    pthread_t       merge_thread;
+    tree_snapshot  *current;
+    int32_t         merging;       // the merge thread is building a base
+    int32_t         stop;
+    int32_t         flush_pending; // a flush is waiting for the next merge
+    int32_t        *log;           // updates since the merge started, as (key, op)
+    size_t          log_size;
+    size_t          log_capacity;
+    size_t          num_updates;   // successful updates
+    size_t          num_merges;
+    size_t          stuck_at;      // num_updates when a merge last failed, or SIZE_MAX
+} updatable_tree;
+
+/**
+ * takes ownership of tree, which must not be used directly afterwards,
+ * and starts the merge thread; rebuilt trees keep tree's fanouts and
+ * allocation flags
+ */
+void init_updatable_tree(partition_tree *tree, updatable_tree *u);
+
+/**
+ * inserts a delimiter; returns 0, or -1 with errno set to EEXIST if the
+ * delimiter is present or EAGAIN if the delta is full
+ */
+int updatable_tree_insert(updatable_tree *u, int32_t key);
+
+/**
+ * deletes a delimiter; returns 0, or -1 with errno set to ENOENT if the
+ * delimiter is absent or EAGAIN if the delta is full
+ */
+int updatable_tree_delete(updatable_tree *u, int32_t key);
+
+/**
+ * current snapshot, valid until released; cheap, so take one per batch
+ */
+tree_snapshot *acquire_snapshot(updatable_tree *u);
+void release_snapshot(tree_snapshot *snapshot);
+
+/**
+ * batched search of a snapshot, ranges count the delimiters less than
+ * each probe as for binary_search_partition_batch
+ */
+void snapshot_search(tree_snapshot *snapshot, size_t num_probes,
+                     const int32_t *probes, int32_t *ranges);
+
+/**
+ * number of delimiters in a snapshot
+ */
+int32_t snapshot_num_keys(tree_snapshot *snapshot);
+
+/**
+ * waits until pending updates are merged into the base tree, or a merge
+ * is impossible because the key count left the bounds of the fanouts
+ */
+void updatable_tree_flush(updatable_tree *u);
+
+/**
+ * stops the merge thread and frees everything once no snapshot is held
+ */
+void destroy_updatable_tree(updatable_tree *u);
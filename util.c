@@ -0,0 +1,26 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+
+void *malloc_or_die(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
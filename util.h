@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+// small helpers shared by the modules
+
+/**
+ * malloc that exits with an error when out of memory; size 0 still
+ * returns a pointer that can be freed
+ */
+void *malloc_or_die(size_t size);
+
+/**
+ * n rounded up to a multiple of align
+ */
+size_t round_up(size_t n, size_t align);
+
+/**
+ * seconds on the monotonic clock, for wall time differences
+ */
+double now(void);
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "verify.h"
+#include "util.h"
+
+// stable LSD radix sort of (probe, position) pairs on the probe, kept in
+// the upper half with the sign bit flipped so the pairs sort as unsigned
+static void sort_pairs(size_t n, uint64_t *pairs, uint64_t *tmp) {
+    int32_t shift;
+    for (shift = 32; shift < 64; shift += 8) {
+        size_t counts[256] = { 0 };
+        size_t i, offset = 0;
+        int32_t b;
+        for (i = 0; i < n; i++)
+            counts[(pairs[i] >> shift) & 0xff]++;
+        for (b = 0; b < 256; b++) {
+            size_t count = counts[b];
+            counts[b] = offset;
+            offset += count;
+        }
+        for (i = 0; i < n; i++)
+            tmp[counts[(pairs[i] >> shift) & 0xff]++] = pairs[i];
+
+        uint64_t *swap = pairs;
+        pairs = tmp;
+        tmp   = swap;
+    }
+    // four passes, the sorted pairs are back in the caller's array
+}
+
+size_t verify_ranges(int32_t num_keys, const int32_t *keys, size_t num_probes,
+                     const int32_t *probes, const int32_t *ranges, size_t sample,
+                     size_t *num_checked) {
+    size_t step = sample > 0 && sample < num_probes ? num_probes / sample : 1;
+    size_t n    = (num_probes + step - 1) / step;
+    *num_checked = n;
+
+    uint64_t *pairs = malloc_or_die(sizeof(uint64_t) * n);
+    uint64_t *tmp   = malloc_or_die(sizeof(uint64_t) * n);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        uint32_t probe = (uint32_t) probes[i * step] ^ 0x80000000u;
+        pairs[i] = (uint64_t) probe << 32 | (uint32_t) i;
+    }
+    sort_pairs(n, pairs, tmp);
+    free(tmp);
+
+    // walk keys and sorted probes together: expected is the number of
+    // keys passed, i.e. less than the probe
+    size_t  mismatches = 0;
+    int32_t expected   = 0;
+    for (i = 0; i < n; i++) {
+        size_t  index = (size_t) (uint32_t) pairs[i] * step;
+        int32_t probe = probes[index];
+        while (expected < num_keys && keys[expected] < probe)
+            expected++;
+
+        if (ranges[index] != expected) {
+            if (mismatches < VERIFY_MAX_REPORTS)
+                printf("mismatch: probe %d at %zu, expected range %d, actual %d\n",
+                       probe, index, expected, ranges[index]);
+            mismatches++;
+        }
+    }
+    if (mismatches > VERIFY_MAX_REPORTS)
+        printf("... %zu more mismatches\n", mismatches - VERIFY_MAX_REPORTS);
+
+    free(pairs);
+    return mismatches;
+}
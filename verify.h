@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bulk check of search results against the sorted keys: the probes are
+// sorted together with their positions and merged with the keys, so the
+// expected range of every probe (the number of keys less than it) comes
+// out of one pass, O(keys + probes) after a radix sort
+
+// mismatches printed in detail, the rest are only counted
+#define VERIFY_MAX_REPORTS 10
+
+/**
+ * checks ranges[i] for every probe, or for about sample probes spread
+ * evenly over the input when sample is positive; keys must be sorted
+ * prints the first VERIFY_MAX_REPORTS mismatches with the probe, expected
+ * and actual range, and returns the number of mismatches; the number of
+ * probes checked goes to num_checked
+ */
+size_t verify_ranges(int32_t num_keys, const int32_t *keys, size_t num_probes,
+                     const int32_t *probes, const int32_t *ranges, size_t sample,
+                     size_t *num_checked);